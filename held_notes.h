@@ -0,0 +1,110 @@
+/**
+ * @file held_notes.h
+ * @brief the notes a route has turned on and not yet turned off
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+namespace rppicomidi
+{
+/**
+ * @brief a bit for each MIDI channel and note number that is held
+ *
+ * A route with a transform keeps one of these so that it can turn its
+ * notes off through the old transform before the transform changes.
+ * Notes are tracked as they arrive, before the transform.
+ */
+class Held_notes
+{
+public:
+    Held_notes() { clear(); }
+
+    void clear()
+    {
+        for (auto& channel : bits)
+        {
+            for (auto& word : channel)
+                word = 0;
+        }
+    }
+
+    bool any() const
+    {
+        for (auto& channel : bits)
+        {
+            for (auto word : channel)
+            {
+                if (word != 0)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    bool test(uint8_t channel, uint8_t note) const { return (bits[channel & 0xF][(note & 0x7F) / 32] & (1ul << (note % 32))) != 0; }
+
+    /**
+     * @brief update the held notes from a packet. A Note On with a non-zero
+     * velocity holds its note; a Note Off or a Note On with velocity 0
+     * releases it. Other messages change nothing.
+     */
+    void track(const uint8_t packet[4])
+    {
+        uint8_t kind = packet[1] & 0xF0;
+        if (kind != 0x80 && kind != 0x90)
+            return;
+        uint32_t& word = bits[packet[1] & 0xF][(packet[2] & 0x7F) / 32];
+        uint32_t bit = 1ul << (packet[2] % 32);
+        if (kind == 0x90 && packet[3] != 0)
+            word |= bit;
+        else
+            word &= ~bit;
+    }
+
+    /**
+     * @brief call fn(channel, note) for every held note, lowest channel
+     * and note first
+     */
+    template<typename Fn>
+    void for_each(Fn fn) const
+    {
+        for (uint8_t channel = 0; channel < 16; channel++)
+        {
+            for (uint8_t word_idx = 0; word_idx < 4; word_idx++)
+            {
+                uint32_t word = bits[channel][word_idx];
+                while (word != 0)
+                {
+                    uint8_t bit = __builtin_ctz(word);
+                    word &= word - 1; // clear the lowest set bit
+                    fn(channel, static_cast<uint8_t>(word_idx * 32 + bit));
+                }
+            }
+        }
+    }
+private:
+    uint32_t bits[16][4]; // bits[channel][n / 32] bit n % 32 is set if note n is held
+};
+}
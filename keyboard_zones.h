@@ -0,0 +1,268 @@
+/**
+ * @file keyboard_zones.h
+ * @brief split the notes from one MIDI IN port into zones by note range,
+ * each with its own set of MIDI OUT ports
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+#include "port_mask.h"
+namespace rppicomidi
+{
+/**
+ * @brief decide which MIDI OUT ports get each note message from a MIDI IN port
+ *
+ * A zone is a range of note numbers and a set of MIDI OUT port indices.
+ * Zones may not overlap, so a 128-entry table gives the zone of any note.
+ * A port that is in no zone gets every note; a port in a zone only gets
+ * the notes of its zones.
+ *
+ * Each zone, and the notes in no zone, send to a target: the full set of
+ * MIDI OUT ports its notes go to. A Note On remembers its target, so the
+ * Note Off and any Polyphonic Key Pressure go where the Note On went. If a
+ * zone changes while some of its notes are held, the held notes keep the
+ * old target and the zone moves to a spare one. The old target becomes a
+ * spare again when its last note is released.
+ */
+template<size_t num_ports>
+class Keyboard_zones
+{
+public:
+    static const uint8_t max_zones = 8;
+    static const uint8_t no_zone = max_zones; // the zone of a note that is in no zone
+    // one target for each zone and one for the notes in no zone, each with a spare
+    static const uint8_t max_targets = 2 * (max_zones + 1);
+
+    struct Zone
+    {
+        bool in_use;
+        uint8_t lowest;
+        uint8_t highest;
+        Port_mask<num_ports> sends_to;
+    };
+
+    Keyboard_zones() { clear(); }
+
+    /**
+     * @brief remove all zones and forget all held notes
+     */
+    void clear()
+    {
+        for (auto& zone : zones)
+        {
+            zone.in_use = false;
+            zone.sends_to.clear();
+        }
+        for (auto& channel : held_target)
+        {
+            for (auto& note : channel)
+                note = 0;
+        }
+        for (uint8_t idx = 0; idx < max_targets; idx++)
+        {
+            targets[idx].clear();
+            num_held[idx] = 0;
+        }
+        for (uint8_t idx = 0; idx <= max_zones; idx++)
+            zone_target[idx] = idx;
+        rebuild();
+    }
+
+    bool empty() const { return !zoned_ports.any(); }
+    const Zone& get_zone(uint8_t idx) const { return zones[idx]; }
+
+    /**
+     * @brief set the note range and the MIDI OUT ports of zone idx
+     *
+     * @return false if idx or the note range is invalid, sends_to is empty
+     * or the note range overlaps another zone
+     */
+    bool set_zone(uint8_t idx, uint8_t lowest, uint8_t highest, const Port_mask<num_ports>& sends_to)
+    {
+        if (idx >= max_zones || lowest > highest || highest > 127 || !sends_to.any())
+            return false;
+        for (uint8_t other = 0; other < max_zones; other++)
+        {
+            if (other != idx && zones[other].in_use && lowest <= zones[other].highest && highest >= zones[other].lowest)
+                return false;
+        }
+        zones[idx].in_use = true;
+        zones[idx].lowest = lowest;
+        zones[idx].highest = highest;
+        zones[idx].sends_to = sends_to;
+        rebuild();
+        return true;
+    }
+
+    /**
+     * @brief remove all zones but not the held notes, which still go
+     * where their Note Ons went
+     */
+    void remove_zones()
+    {
+        for (auto& zone : zones)
+        {
+            zone.in_use = false;
+            zone.sends_to.clear();
+        }
+        rebuild();
+    }
+
+    void remove_zone(uint8_t idx)
+    {
+        if (idx >= max_zones)
+            return;
+        zones[idx].in_use = false;
+        zones[idx].sends_to.clear();
+        rebuild();
+    }
+
+    /**
+     * @brief take MIDI OUT port port_idx out of every zone. Zones with
+     * no MIDI OUT ports left are removed.
+     */
+    void remove_port(size_t port_idx)
+    {
+        for (auto& zone : zones)
+        {
+            zone.sends_to.reset(port_idx);
+            if (!zone.sends_to.any())
+                zone.in_use = false;
+        }
+        rebuild();
+    }
+
+    /**
+     * @brief return true if packet is a Note On, Note Off or Polyphonic Key
+     * Pressure message. Zones only apply to these messages.
+     */
+    static bool is_note_message(const uint8_t packet[4]) { return packet[1] >= 0x80 && packet[1] < 0xB0; }
+
+    /**
+     * @brief get the target of a note message and keep track of which notes
+     * are held. Call once per message, and only if is_note_message(packet).
+     *
+     * @return the target to pass to sends_to()
+     */
+    uint8_t resolve(const uint8_t packet[4])
+    {
+        uint8_t kind = packet[1] & 0xF0;
+        uint8_t note = packet[2] & 0x7F;
+        uint8_t& held = held_target[packet[1] & 0xF][note];
+        if (kind == 0x90 && packet[3] != 0)
+        {
+            if (held != 0)
+                --num_held[held - 1]; // the note was turned on again without a Note Off
+            uint8_t target = zone_target[note_zone[note]];
+            ++num_held[target];
+            held = target + 1;
+            return target;
+        }
+        if (held == 0)
+            return zone_target[note_zone[note]];
+        uint8_t target = held - 1;
+        if (kind != 0xA0)
+        {
+            // a Note Off
+            --num_held[target];
+            held = 0;
+        }
+        return target;
+    }
+
+    /**
+     * @brief return true if the notes of target go to MIDI OUT port port_idx
+     */
+    bool sends_to(uint8_t target, size_t port_idx) const { return targets[target].test(port_idx); }
+private:
+    void rebuild()
+    {
+        for (auto& zone : note_zone)
+            zone = no_zone;
+        zoned_ports.clear();
+        for (uint8_t idx = 0; idx < max_zones; idx++)
+        {
+            if (!zones[idx].in_use)
+                continue;
+            for (uint8_t note = zones[idx].lowest; note <= zones[idx].highest && note < 128; note++)
+                note_zone[note] = idx;
+            zones[idx].sends_to.for_each([this](size_t port_idx) { zoned_ports.set(port_idx); });
+        }
+        for (uint8_t idx = 0; idx <= max_zones; idx++)
+        {
+            if (idx != no_zone && !zones[idx].in_use)
+                continue;
+            Port_mask<num_ports> sends_to;
+            for (size_t port_idx = 0; port_idx < num_ports; port_idx++)
+            {
+                if (!zoned_ports.test(port_idx) || (idx != no_zone && zones[idx].sends_to.test(port_idx)))
+                    sends_to.set(port_idx);
+            }
+            set_target(idx, sends_to);
+        }
+    }
+
+    /**
+     * @brief make sends_to the target of zone idx, or of the notes in no
+     * zone if idx is no_zone, without changing where its held notes go
+     */
+    void set_target(uint8_t idx, const Port_mask<num_ports>& sends_to)
+    {
+        uint8_t& target = zone_target[idx];
+        if (num_held[target] != 0 && !(targets[target] == sends_to))
+        {
+            // If every spare still has held notes, the held notes of this
+            // zone follow it to its new MIDI OUT ports
+            for (uint8_t spare = 0; spare < max_targets; spare++)
+            {
+                if (num_held[spare] == 0 && !is_zone_target(spare))
+                {
+                    target = spare;
+                    break;
+                }
+            }
+        }
+        targets[target] = sends_to;
+    }
+
+    bool is_zone_target(uint8_t target) const
+    {
+        for (uint8_t idx = 0; idx <= max_zones; idx++)
+        {
+            if (zone_target[idx] == target)
+                return true;
+        }
+        return false;
+    }
+
+    Zone zones[max_zones];
+    uint8_t note_zone[128];                 // note_zone[n] is the zone of note n
+    uint8_t zone_target[max_zones + 1];     // zone_target[z] is the target of zone z; zone_target[no_zone] is the target of the notes in no zone
+    Port_mask<num_ports> targets[max_targets]; // the MIDI OUT ports each target sends to
+    uint16_t num_held[max_targets];         // the number of held notes that use each target
+    uint8_t held_target[16][128];           // held_target[channel][n] is 1 + the target of held note n, or 0 if it is not held
+    Port_mask<num_ports> zoned_ports;       // the MIDI OUT ports in any zone
+};
+}
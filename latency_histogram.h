@@ -0,0 +1,86 @@
+/**
+ * @file latency_histogram.h
+ * @brief a latency histogram with power of 2 sized buckets
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+namespace rppicomidi
+{
+/**
+ * @brief count latency samples in buckets whose upper bounds are powers of 2
+ *
+ * Bucket 0 counts 0 us samples, bucket n counts samples from 2^(n-1) us up
+ * to 2^n - 1 us, and the last bucket also counts everything longer. Adding
+ * a sample costs a count leading zeros instruction and a few increments.
+ */
+class Latency_histogram
+{
+public:
+    static const uint8_t num_buckets = 20;
+
+    Latency_histogram() { reset(); }
+
+    void reset()
+    {
+        for (auto& bucket : buckets)
+            bucket = 0;
+        count = 0;
+        max_us = 0;
+    }
+
+    void add(uint32_t latency_us)
+    {
+        uint8_t idx = latency_us == 0 ? 0 : 32 - __builtin_clz(latency_us);
+        if (idx >= num_buckets)
+            idx = num_buckets - 1;
+        ++buckets[idx];
+        ++count;
+        if (latency_us > max_us)
+            max_us = latency_us;
+    }
+
+    uint32_t get_bucket(uint8_t idx) const { return idx < num_buckets ? buckets[idx] : 0; }
+
+    uint32_t get_count() const { return count; }
+
+    uint32_t get_max_us() const { return max_us; }
+
+    /**
+     * @brief get the shortest latency counted in bucket idx
+     */
+    static uint32_t get_bucket_min_us(uint8_t idx) { return idx == 0 ? 0 : 1ul << (idx - 1); }
+
+    /**
+     * @brief get the longest latency counted in bucket idx; UINT32_MAX
+     * for the last bucket
+     */
+    static uint32_t get_bucket_max_us(uint8_t idx) { return idx + 1 >= num_buckets ? UINT32_MAX : (1ul << idx) - 1; }
+private:
+    uint32_t buckets[num_buckets];
+    uint32_t count;
+    uint32_t max_us;
+};
+}
@@ -0,0 +1,75 @@
+/**
+ * @file merge_rules.h
+ * @brief decide what the merge stage of a MIDI OUT port does with each message
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+#include "midi_packet.h"
+namespace rppicomidi
+{
+namespace merge_rules
+{
+    // What the merge stage of a MIDI OUT port does with a message
+    enum class Merge : uint8_t
+    {
+        send,   // send it now
+        hold,   // hold it until another MIDI IN port's SysEx message ends
+        orphan, // drop it; it is the rest of a SysEx message the hub ended because it timed out
+    };
+
+    /**
+     * @brief return true if the packet is the first packet of a SysEx message
+     */
+    inline bool is_sysex_start(const uint8_t packet[4]) { return midi_packet::is_sysex(packet) && packet[1] == 0xF0; }
+
+    /**
+     * @brief decide what the merge stage of a MIDI OUT port does with a message
+     *
+     * @param sender_owns_sysex true if the message's MIDI IN port is in the
+     * middle of a SysEx message to the MIDI OUT port
+     * @param other_owns_sysex true if another MIDI IN port is
+     */
+    inline Merge get_merge(const uint8_t packet[4], bool sender_owns_sysex, bool other_owns_sysex)
+    {
+        if (midi_packet::is_realtime(packet))
+            return Merge::send; // allowed anywhere, even in the middle of a SysEx message
+        if (other_owns_sysex)
+            return Merge::hold;
+        if (midi_packet::is_sysex(packet) && !is_sysex_start(packet) && !sender_owns_sysex)
+            return Merge::orphan;
+        return Merge::send;
+    }
+
+    /**
+     * @brief return true if the sender of a SysEx message stopped sending
+     * it for timeout_ms or longer
+     *
+     * @param last_time the time_us_32() time the sender last sent part of it
+     * @param now the time_us_32() time
+     */
+    inline bool is_sysex_timed_out(uint32_t last_time, uint32_t timeout_ms, uint32_t now) { return now - last_time >= timeout_ms * 1000; }
+}
+}
@@ -31,13 +31,21 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <cstring>
 #include "midi2usbhub.h"
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
 #include "midi_uart_lib.h"
+#include "midi_uart_lib_config.h"
+#include "hardware/structs/scb.h"
 #include "bsp/board_api.h"
 #include "preset_manager.h"
 #include "diskio.h"
+#include "midi_packet.h"
+#include "routing_core_lockout.h"
+#if MIDI2USBHUB_DUAL_CORE
+#include "pico/multicore.h"
+#endif
 #ifdef RPPICOMIDI_PICO_W
 #include "pico/cyw43_arch.h"
 #endif
@@ -70,20 +78,261 @@ void rppicomidi::Midi2usbhub::serialize(std::string &serialized_string)
     {
         JSON_Value *routing = json_value_init_array();
         JSON_Array *routing_array = json_value_get_array(routing);
-        for (auto &midi_out : midi_in->sends_data_to_list)
-        {
-            json_array_append_string(routing_array, midi_out->nickname.c_str());
-        }
+        midi_in->sends_data_to.for_each([&](size_t idx) {
+            json_array_append_string(routing_array, out_port_by_index[idx]->nickname.c_str());
+        });
         json_object_set_value(routing_object, midi_in->nickname.c_str(), json_array_get_wrapping_value(routing_array));
     }
     json_object_set_value(root_object, "routing", routing_value);
 
+    JSON_Value *zones_value = json_value_init_object();
+    JSON_Object *zones_object = json_value_get_object(zones_value);
+    for (auto &midi_in : midi_in_port_list)
+    {
+        auto zones = get_zones(midi_in);
+        if (zones == nullptr)
+            continue;
+        JSON_Value *zone_list = json_value_init_array();
+        for (uint8_t zone_idx = 0; zone_idx < Input_zones::max_zones; zone_idx++) {
+            auto& zone = zones->get_zone(zone_idx);
+            if (!zone.in_use)
+                continue;
+            JSON_Value *zone_value = json_value_init_object();
+            JSON_Object *zone_object = json_value_get_object(zone_value);
+            json_object_set_number(zone_object, "zone", zone_idx + 1);
+            json_object_set_number(zone_object, "lowest", zone.lowest);
+            json_object_set_number(zone_object, "highest", zone.highest);
+            JSON_Value *to_value = json_value_init_array();
+            zone.sends_to.for_each([&](size_t idx) {
+                json_array_append_string(json_value_get_array(to_value), out_port_by_index[idx]->nickname.c_str());
+            });
+            json_object_set_value(zone_object, "to", to_value);
+            json_array_append_value(json_value_get_array(zone_list), zone_value);
+        }
+        json_object_set_value(zones_object, midi_in->nickname.c_str(), zone_list);
+    }
+    json_object_set_value(root_object, "zones", zones_value);
+
+    JSON_Value *delays_value = json_value_init_object();
+    JSON_Object *delays_object = json_value_get_object(delays_value);
+    for (auto &midi_in : midi_in_port_list)
+    {
+        JSON_Value *delays = nullptr;
+        midi_in->sends_data_to.for_each([&](size_t idx) {
+            if (midi_in->delay_ms[idx] == 0)
+                return;
+            if (delays == nullptr)
+                delays = json_value_init_object();
+            json_object_set_number(json_value_get_object(delays), out_port_by_index[idx]->nickname.c_str(), midi_in->delay_ms[idx]);
+        });
+        if (delays != nullptr)
+            json_object_set_value(delays_object, midi_in->nickname.c_str(), delays);
+    }
+    json_object_set_value(root_object, "delays", delays_value);
+
+    JSON_Value *filters_value = json_value_init_object();
+    JSON_Object *filters_object = json_value_get_object(filters_value);
+    for (auto &midi_in : midi_in_port_list)
+    {
+        JSON_Value *filters = nullptr;
+        midi_in->sends_data_to.for_each([&](size_t idx) {
+            auto& filter = midi_in->filter[idx];
+            if (filter.passes_all())
+                return;
+            if (filters == nullptr)
+                filters = json_value_init_object();
+            JSON_Value *filter_value = json_value_init_object();
+            JSON_Object *filter_object = json_value_get_object(filter_value);
+            json_object_set_number(filter_object, "channels", filter.get_channels());
+            json_object_set_number(filter_object, "classes", filter.get_classes());
+            json_object_set_value(json_value_get_object(filters), out_port_by_index[idx]->nickname.c_str(), filter_value);
+        });
+        if (filters != nullptr)
+            json_object_set_value(filters_object, midi_in->nickname.c_str(), filters);
+    }
+    json_object_set_value(root_object, "filters", filters_value);
+
+    JSON_Value *transforms_value = json_value_init_object();
+    JSON_Object *transforms_object = json_value_get_object(transforms_value);
+    for (auto &midi_in : midi_in_port_list)
+    {
+        JSON_Value *transforms = nullptr;
+        midi_in->sends_data_to.for_each([&](size_t idx) {
+            auto transform = get_route_transform(midi_in, idx);
+            if (transform == nullptr)
+                return;
+            if (transforms == nullptr)
+                transforms = json_value_init_object();
+            JSON_Value *stages_value = json_value_init_array();
+            JSON_Array *stages_array = json_value_get_array(stages_value);
+            for (uint8_t stage_idx = 0; stage_idx < transform->get_num_stages(); stage_idx++) {
+                auto& stage = transform->get_stage(stage_idx);
+                JSON_Value *stage_value = json_value_init_object();
+                JSON_Object *stage_object = json_value_get_object(stage_value);
+                json_object_set_string(stage_object, "type", Route_transform::get_stage_type_name(stage.type));
+                JSON_Value *params_value = json_value_init_array();
+                for (auto param : stage.params)
+                    json_array_append_number(json_value_get_array(params_value), param);
+                json_object_set_value(stage_object, "params", params_value);
+                json_array_append_value(stages_array, stage_value);
+            }
+            json_object_set_value(json_value_get_object(transforms), out_port_by_index[idx]->nickname.c_str(), stages_value);
+        });
+        if (transforms != nullptr)
+            json_object_set_value(transforms_object, midi_in->nickname.c_str(), transforms);
+    }
+    json_object_set_value(root_object, "transforms", transforms_value);
+
     auto ser = json_serialize_to_string(root_value);
     serialized_string = std::string(ser);
     json_free_serialized_string(ser);
     json_value_free(root_value);
 }
 
+void rppicomidi::Midi2usbhub::serialize_device_profiles(std::string& serialized_profiles)
+{
+    static const char* flush_names[] = {"latency", "throughput"};
+    JSON_Value *root_value = json_value_init_object();
+    JSON_Object *root_object = json_value_get_object(root_value);
+    for (auto& profile : device_profiles)
+    {
+        char key[10];
+        snprintf(key, sizeof(key), "%04x-%04x", profile.vid, profile.pid);
+        JSON_Value *profile_value = json_value_init_object();
+        JSON_Object *profile_object = json_value_get_object(profile_value);
+        json_object_set_number(profile_object, "max_packets_per_second", profile.max_packets_per_second);
+        json_object_set_number(profile_object, "sysex_gap_us", profile.sysex_gap_us);
+        json_object_set_string(profile_object, "flush",
+                               profile.use_flush_mode ? flush_names[static_cast<uint8_t>(profile.flush_mode)] : "default");
+        json_object_set_value(root_object, key, profile_value);
+    }
+    auto ser = json_serialize_to_string(root_value);
+    serialized_profiles = std::string(ser);
+    json_free_serialized_string(ser);
+    json_value_free(root_value);
+}
+
+bool rppicomidi::Midi2usbhub::deserialize_device_profiles(std::string& serialized_profiles)
+{
+    JSON_Value* root_value = json_parse_string(serialized_profiles.c_str());
+    if (root_value == nullptr) {
+        return false;
+    }
+    JSON_Object* root_object = json_value_get_object(root_value);
+    if (root_object == nullptr) {
+        json_value_free(root_value);
+        return false;
+    }
+    std::vector<Device_profile> profiles;
+    size_t count = json_object_get_count(root_object);
+    for (size_t idx = 0; idx < count; idx++) {
+        const char* key = json_object_get_name(root_object, idx);
+        JSON_Object* profile_object = json_value_get_object(json_object_get_value_at(root_object, idx));
+        unsigned vid, pid;
+        if (profile_object == nullptr || sscanf(key, "%4x-%4x", &vid, &pid) != 2) {
+            // poorly formatted JSON
+            json_value_free(root_value);
+            return false;
+        }
+        Device_profile profile;
+        profile.vid = vid;
+        profile.pid = pid;
+        profile.max_packets_per_second = json_object_get_number(profile_object, "max_packets_per_second");
+        profile.sysex_gap_us = json_object_get_number(profile_object, "sysex_gap_us");
+        profile.use_flush_mode = true;
+        profile.flush_mode = Usb_flush_mode::latency;
+        const char* flush = json_object_get_string(profile_object, "flush");
+        if (flush == nullptr || strcmp(flush, "default") == 0)
+            profile.use_flush_mode = false;
+        else if (strcmp(flush, "throughput") == 0)
+            profile.flush_mode = Usb_flush_mode::throughput;
+        else if (strcmp(flush, "latency") != 0) {
+            json_value_free(root_value);
+            return false;
+        }
+        profiles.push_back(profile);
+    }
+    json_value_free(root_value);
+    device_profiles = profiles;
+    for (uint8_t devaddr = 1; devaddr <= CFG_TUH_DEVICE_MAX; devaddr++) {
+        if (attached_devices[devaddr].configured)
+            apply_device_profile(devaddr);
+    }
+    return true;
+}
+
+bool rppicomidi::Midi2usbhub::save_device_profiles()
+{
+    std::string serialized_profiles;
+    serialize_device_profiles(serialized_profiles);
+    return preset_manager.save_device_profiles(serialized_profiles);
+}
+
+bool rppicomidi::Midi2usbhub::load_device_profiles()
+{
+    std::string serialized_profiles;
+    if (!preset_manager.load_device_profiles(serialized_profiles))
+        return false;
+    if (!deserialize_device_profiles(serialized_profiles)) {
+        printf("error deserializing the device profiles\r\n");
+        return false;
+    }
+    return true;
+}
+
+void rppicomidi::Midi2usbhub::set_device_profile(const Device_profile& profile)
+{
+    bool found = false;
+    for (auto& existing : device_profiles) {
+        if (existing.vid == profile.vid && existing.pid == profile.pid) {
+            existing = profile;
+            found = true;
+        }
+    }
+    if (!found)
+        device_profiles.push_back(profile);
+    for (uint8_t devaddr = 1; devaddr <= CFG_TUH_DEVICE_MAX; devaddr++) {
+        if (attached_devices[devaddr].configured)
+            apply_device_profile(devaddr);
+    }
+}
+
+bool rppicomidi::Midi2usbhub::delete_device_profile(uint16_t vid, uint16_t pid)
+{
+    for (auto it = device_profiles.begin(); it != device_profiles.end(); ++it) {
+        if (it->vid == vid && it->pid == pid) {
+            device_profiles.erase(it);
+            for (uint8_t devaddr = 1; devaddr <= CFG_TUH_DEVICE_MAX; devaddr++) {
+                if (attached_devices[devaddr].configured)
+                    apply_device_profile(devaddr);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void rppicomidi::Midi2usbhub::apply_device_profile(uint8_t dev_addr)
+{
+    auto& flush = usb_flush[dev_addr];
+    auto& info = attached_devices[dev_addr];
+    flush.pacer.configure(0, 0, time_us_32());
+    flush.sysex_gap_us = 0;
+    flush.use_flush_mode = false;
+    for (auto& profile : device_profiles) {
+        if (profile.vid == info.vid && profile.pid == info.pid) {
+            // allow about 1 ms worth of packets back to back
+            uint32_t burst = profile.max_packets_per_second / 1000;
+            flush.pacer.configure(profile.max_packets_per_second, burst == 0 ? 1 : burst, time_us_32());
+            flush.sysex_gap_us = profile.sysex_gap_us;
+            flush.use_flush_mode = profile.use_flush_mode;
+            flush.flush_mode = profile.flush_mode;
+            TU_LOG1("device %04x-%04x: using its device profile\r\n", info.vid, info.pid);
+            break;
+        }
+    }
+}
+
 bool rppicomidi::Midi2usbhub::deserialize(std::string &serialized_string)
 {
     JSON_Value* root_value = json_parse_string(serialized_string.c_str());
@@ -144,48 +393,232 @@ bool rppicomidi::Midi2usbhub::deserialize(std::string &serialized_string)
         return false;
     }
     JSON_Object* routing_object = json_value_get_object(routing_value);
-    if (routing_object) {
-        for (auto& midi_in: midi_in_port_list) {
-            JSON_Array* routes = json_object_get_array(routing_object, midi_in->nickname.c_str());
-            if (routes) {
-                midi_in->sends_data_to_list.clear();
-                size_t count = json_array_get_count(routes);
-                for (size_t idx = 0; idx < count; idx++) {
-                    const char* to_nickname = json_array_get_string(routes, idx);
-                    if (to_nickname) {
-                        std::string nickname = std::string(to_nickname);
-                        // Find to_nickname in the midi_out_port_list
-                        for (auto& midi_out: midi_out_port_list ) {
-                            if (nickname == midi_out->nickname) {
-                                // it's connected, so route it
-                                midi_in->sends_data_to_list.push_back(midi_out);
-                                break;
-                            }
-                        }
-                    }
-                    else {
-                        // poorly formatted JSON
-                        json_value_free(root_value);
-                        return false;
-                    }
-                }
-            }
-            else {
+    if (routing_object == nullptr) {
+        // poorly formatted JSON
+        json_value_free(root_value);
+        return false;
+    }
+    // Parse the whole preset before changing any routes. The routing core
+    // only waits for the routing lock while the parsed routes are copied in.
+    std::vector<Route_mask> staged_routing;
+    for (auto& midi_in: midi_in_port_list) {
+        JSON_Array* routes = json_object_get_array(routing_object, midi_in->nickname.c_str());
+        if (routes == nullptr) {
+            // poorly formatted JSON
+            json_value_free(root_value);
+            return false;
+        }
+        Route_mask sends_to;
+        size_t count = json_array_get_count(routes);
+        for (size_t idx = 0; idx < count; idx++) {
+            const char* to_nickname = json_array_get_string(routes, idx);
+            if (to_nickname == nullptr) {
                 // poorly formatted JSON
                 json_value_free(root_value);
                 return false;
             }
+            // Find to_nickname in the midi_out_port_list
+            for (auto& midi_out: midi_out_port_list ) {
+                if (midi_out->nickname == to_nickname) {
+                    // it's connected, so route it
+                    sends_to.set(midi_out->index);
+                    break;
+                }
+            }
         }
+        staged_routing.push_back(sends_to);
     }
-    else {
-        // poorly formatted JSON
-        json_value_free(root_value);
-        return false;
+    // the settings of one route that are not the defaults
+    struct Staged_route {
+        Midi_in_port* midi_in;
+        size_t to_index;
+        uint16_t delay_ms;
+        Route_filter filter;
+        size_t transform; // 1 + the index in staged_transforms, or 0 for none
+    };
+    struct Staged_zone {
+        Midi_in_port* midi_in;
+        uint8_t zone;
+        uint8_t lowest;
+        uint8_t highest;
+        Route_mask sends_to;
+    };
+    std::vector<Staged_route> staged_routes;
+    std::vector<Route_transform> staged_transforms;
+    std::vector<Route_mask> staged_transform_routes; // the routes of each MIDI IN port with a transform
+    std::vector<Staged_zone> staged_zones;
+    size_t num_zoned_inputs = 0;
+    // Presets saved before route delays, filters, transforms and keyboard
+    // zones existed have no "delays", "filters", "transforms" or "zones"
+    JSON_Object* delays_object = json_object_get_object(root_object, "delays");
+    JSON_Object* filters_object = json_object_get_object(root_object, "filters");
+    JSON_Object* transforms_object = json_object_get_object(root_object, "transforms");
+    JSON_Object* zones_object = json_object_get_object(root_object, "zones");
+    auto routing = staged_routing.begin();
+    for (auto& midi_in: midi_in_port_list) {
+        const Route_mask& sends_data_to = *routing++;
+        JSON_Object* delays = delays_object ? json_object_get_object(delays_object, midi_in->nickname.c_str()) : nullptr;
+        JSON_Object* filters = filters_object ? json_object_get_object(filters_object, midi_in->nickname.c_str()) : nullptr;
+        JSON_Object* transforms = transforms_object ? json_object_get_object(transforms_object, midi_in->nickname.c_str()) : nullptr;
+        Route_mask transform_routes;
+        for (auto& midi_out: midi_out_port_list) {
+            if (!sends_data_to.test(midi_out->index))
+                continue;
+            Staged_route route = {midi_in, midi_out->index, 0, Route_filter(), 0};
+            double delay_ms = delays ? json_object_get_number(delays, midi_out->nickname.c_str()) : 0;
+            if (delay_ms > 0 && delay_ms <= MIDI2USBHUB_MAX_ROUTE_DELAY_MS) {
+                route.delay_ms = static_cast<uint16_t>(delay_ms);
+            }
+            JSON_Object* filter = filters ? json_object_get_object(filters, midi_out->nickname.c_str()) : nullptr;
+            if (filter && json_object_has_value(filter, "channels") && json_object_has_value(filter, "classes")) {
+                route.filter.set_masks(static_cast<uint16_t>(json_object_get_number(filter, "channels")),
+                                       static_cast<uint16_t>(json_object_get_number(filter, "classes")));
+            }
+            JSON_Array* stages = transforms ? json_object_get_array(transforms, midi_out->nickname.c_str()) : nullptr;
+            if (stages) {
+                Route_transform transform;
+                for (size_t stage_idx = 0; stage_idx < json_array_get_count(stages); stage_idx++) {
+                    JSON_Object* stage = json_array_get_object(stages, stage_idx);
+                    const char* type_name = stage ? json_object_get_string(stage, "type") : nullptr;
+                    JSON_Array* params = stage ? json_object_get_array(stage, "params") : nullptr;
+                    Route_transform::Stage_type type;
+                    if (type_name == nullptr || params == nullptr || !Route_transform::find_stage_type(type_name, type) ||
+                            !transform.add_stage(type, static_cast<int16_t>(json_array_get_number(params, 0)),
+                                                 static_cast<int16_t>(json_array_get_number(params, 1)),
+                                                 static_cast<int16_t>(json_array_get_number(params, 2)))) {
+                        printf("skipping bad transform stage %u from %s to %s\r\n", stage_idx + 1,
+                               midi_in->nickname.c_str(), midi_out->nickname.c_str());
+                    }
+                }
+                // every route transform table entry the preset does not use is free
+                // once the old routes are cleared
+                if (!transform.empty() && staged_transforms.size() == MIDI2USBHUB_MAX_ROUTE_TRANSFORMS) {
+                    printf("no room for the transform from %s to %s\r\n", midi_in->nickname.c_str(), midi_out->nickname.c_str());
+                }
+                else if (!transform.empty()) {
+                    staged_transforms.push_back(transform);
+                    route.transform = staged_transforms.size();
+                    transform_routes.set(midi_out->index);
+                }
+            }
+            if (route.delay_ms != 0 || !route.filter.passes_all() || route.transform != 0)
+                staged_routes.push_back(route);
+        }
+        staged_transform_routes.push_back(transform_routes);
+        JSON_Array* zones = zones_object ? json_object_get_array(zones_object, midi_in->nickname.c_str()) : nullptr;
+        size_t first_zone = staged_zones.size();
+        for (size_t zone_idx = 0; zones && zone_idx < json_array_get_count(zones); zone_idx++) {
+            JSON_Object* zone = json_array_get_object(zones, zone_idx);
+            JSON_Array* to_array = zone ? json_object_get_array(zone, "to") : nullptr;
+            if (to_array == nullptr)
+                continue;
+            Staged_zone staged = {midi_in, 0, 0, 0, Route_mask()};
+            for (size_t to_idx = 0; to_idx < json_array_get_count(to_array); to_idx++) {
+                const char* to_nickname = json_array_get_string(to_array, to_idx);
+                for (auto& midi_out: midi_out_port_list) {
+                    if (to_nickname && midi_out->nickname == to_nickname && sends_data_to.test(midi_out->index))
+                        staged.sends_to.set(midi_out->index);
+                }
+            }
+            // zones whose TO ports are all missing are dropped like their routes
+            if (!staged.sends_to.any())
+                continue;
+            double zone_number = json_object_get_number(zone, "zone");
+            double lowest = json_object_get_number(zone, "lowest");
+            double highest = json_object_get_number(zone, "highest");
+            bool valid = zone_number >= 1 && zone_number <= Input_zones::max_zones && lowest >= 0 && lowest <= highest && highest <= 127 &&
+                (staged_zones.size() > first_zone || num_zoned_inputs < MIDI2USBHUB_MAX_ZONED_INPUTS);
+            if (valid) {
+                staged.zone = static_cast<uint8_t>(zone_number) - 1;
+                staged.lowest = static_cast<uint8_t>(lowest);
+                staged.highest = static_cast<uint8_t>(highest);
+                // the same checks Keyboard_zones::set_zone() makes
+                for (size_t idx = first_zone; idx < staged_zones.size() && valid; idx++) {
+                    const auto& other = staged_zones[idx];
+                    valid = other.zone == staged.zone || staged.lowest > other.highest || staged.highest < other.lowest;
+                }
+            }
+            if (!valid) {
+                printf("skipping bad keyboard zone %u of %s\r\n", zone_idx + 1, midi_in->nickname.c_str());
+                continue;
+            }
+            if (staged_zones.size() == first_zone)
+                ++num_zoned_inputs;
+            staged_zones.push_back(staged);
+        }
     }
     json_value_free(root_value);
+    bool thru_off = false;
+    {
+        Routing_lock lock(&routing_lock);
+        routing = staged_routing.begin();
+        auto transform_routes = staged_transform_routes.begin();
+        for (auto& midi_in: midi_in_port_list) {
+            midi_in->sends_data_to = *routing++;
+            const Route_mask& keeps_transform = *transform_routes++;
+            for (size_t idx = 0; idx < max_out_ports; idx++) {
+                midi_in->delay_ms[idx] = 0;
+                midi_in->filter[idx] = Route_filter();
+                // store_route_transform() below keeps a transform the preset
+                // does not change, along with the notes it holds
+                if (!keeps_transform.test(idx))
+                    clear_route_transform(midi_in, idx);
+            }
+            // the staged zones go back in the same table entry, so the
+            // Note Offs of held notes go where their Note Ons went
+            if (midi_in->zones_slot != 0)
+                keyboard_zones[midi_in->zones_slot - 1].remove_zones();
+        }
+        for (auto& route: staged_routes) {
+            route.midi_in->delay_ms[route.to_index] = route.delay_ms;
+            route.midi_in->filter[route.to_index] = route.filter;
+            if (route.transform != 0)
+                store_route_transform(route.midi_in, route.to_index, staged_transforms[route.transform - 1]);
+        }
+        for (auto& zone: staged_zones) {
+            store_zone(zone.midi_in, zone.zone, zone.lowest, zone.highest, zone.sends_to);
+        }
+        for (auto& midi_in: midi_in_port_list) {
+            release_empty_zones(midi_in);
+        }
+        if (uart_thru && has_other_uart_out_sources()) {
+            uart_thru = false;
+            thru_off = true;
+        }
+        rebuild_in_port_lookup();
+        release_stale_route_latency();
+    }
+    if (thru_off)
+        printf("serial port MIDI thru is off because other FROM ports connect to %s\r\n", uart_midi_out_port.nickname.c_str());
     return true;
 }
 
+bool rppicomidi::Midi2usbhub::assign_out_port_index(Midi_out_port* out_port)
+{
+    for (size_t idx = 0; idx < max_out_ports; idx++) {
+        if (out_port_by_index[idx] == nullptr) {
+            out_port_by_index[idx] = out_port;
+            out_port->index = idx;
+            return true;
+        }
+    }
+    return false;
+}
+
+void rppicomidi::Midi2usbhub::rebuild_in_port_lookup()
+{
+    for (auto& row : in_port_lookup) {
+        for (auto& entry : row) {
+            entry = nullptr;
+        }
+    }
+    for (auto& midi_in : midi_in_port_list) {
+        if (midi_in->devaddr <= uart_devaddr && midi_in->cable < max_cables) {
+            in_port_lookup[midi_in->devaddr][midi_in->cable] = midi_in;
+        }
+    }
+}
+
 
 int rppicomidi::Midi2usbhub::connect(const std::string& from_nickname, const std::string& to_nickname)
 {
@@ -193,7 +626,14 @@ int rppicomidi::Midi2usbhub::connect(const std::string& from_nickname, const std
         if (in_port->nickname == from_nickname) {
             for (auto out_port : midi_out_port_list) {
                 if (out_port->nickname == to_nickname) {
-                    in_port->sends_data_to_list.push_back(out_port);
+                    if (out_port == &uart_midi_out_port && in_port != &uart_midi_in_port && uart_thru)
+                        return -3;
+                    {
+                        Routing_lock lock(&routing_lock);
+                        in_port->sends_data_to.set(out_port->index);
+                    }
+                    if (get_routed_peak_bytes_per_second(out_port) > out_port->shaper.get_bytes_per_second())
+                        return 1;
                     return 0;
                 }
             }
@@ -203,18 +643,28 @@ int rppicomidi::Midi2usbhub::connect(const std::string& from_nickname, const std
     return -2;
 }
 
+uint32_t rppicomidi::Midi2usbhub::get_routed_peak_bytes_per_second(const Midi_out_port* out_port)
+{
+    uint32_t peak = 0;
+    for (auto in_port : midi_in_port_list) {
+        if (in_port->sends_data_to.test(out_port->index))
+            peak += in_port->stats.peak_bytes_per_second;
+    }
+    return peak;
+}
+
 int rppicomidi::Midi2usbhub::disconnect(const std::string& from_nickname, const std::string& to_nickname)
 {
     for (auto &in_port : midi_in_port_list) {
         if (in_port->nickname == from_nickname) {
-            for (auto it = in_port->sends_data_to_list.begin(); it != in_port->sends_data_to_list.end();) {
-                if ((*it)->nickname == to_nickname) {
-                    in_port->sends_data_to_list.erase(it);
+            for (auto out_port : midi_out_port_list) {
+                if (out_port->nickname == to_nickname && in_port->sends_data_to.test(out_port->index)) {
+                    Routing_lock lock(&routing_lock);
+                    in_port->sends_data_to.reset(out_port->index);
+                    clear_route_settings(in_port, out_port->index);
+                    release_stale_route_latency();
                     return 0;
                 }
-                else {
-                    ++it;
-                }
             }
             return -1;
         }
@@ -224,9 +674,253 @@ int rppicomidi::Midi2usbhub::disconnect(const std::string& from_nickname, const
 
 void rppicomidi::Midi2usbhub::reset()
 {
+    Routing_lock lock(&routing_lock);
     for (auto &in_port :midi_in_port_list) {
-        in_port->sends_data_to_list.clear();
+        in_port->sends_data_to.clear();
+        for (size_t idx = 0; idx < max_out_ports; idx++) {
+            clear_route_settings(in_port, idx);
+        }
+    }
+    release_stale_route_latency();
+}
+
+int rppicomidi::Midi2usbhub::set_route_filter(const std::string& from_nickname, const std::string& to_nickname, const Route_filter& filter)
+{
+    for (auto &in_port : midi_in_port_list) {
+        if (in_port->nickname == from_nickname) {
+            for (auto out_port : midi_out_port_list) {
+                if (out_port->nickname == to_nickname && in_port->sends_data_to.test(out_port->index)) {
+                    Routing_lock lock(&routing_lock);
+                    in_port->filter[out_port->index] = filter;
+                    return 0;
+                }
+            }
+            return -1;
+        }
+    }
+    return -2;
+}
+
+int rppicomidi::Midi2usbhub::set_route_transform(const std::string& from_nickname, const std::string& to_nickname, const Route_transform& transform)
+{
+    for (auto &in_port : midi_in_port_list) {
+        if (in_port->nickname == from_nickname) {
+            for (auto out_port : midi_out_port_list) {
+                if (out_port->nickname == to_nickname && in_port->sends_data_to.test(out_port->index)) {
+                    Routing_lock lock(&routing_lock);
+                    if (transform.empty()) {
+                        clear_route_transform(in_port, out_port->index);
+                        return 0;
+                    }
+                    return store_route_transform(in_port, out_port->index, transform) ? 0 : -3;
+                }
+            }
+            return -1;
+        }
+    }
+    return -2;
+}
+
+bool rppicomidi::Midi2usbhub::store_route_transform(Midi_in_port* in_port, size_t to_index, const Route_transform& transform)
+{
+    uint8_t slot = in_port->transform_slot[to_index];
+    if (slot == 0) {
+        for (size_t idx = 0; idx < MIDI2USBHUB_MAX_ROUTE_TRANSFORMS && slot == 0; idx++) {
+            if (route_transforms[idx].empty())
+                slot = idx + 1;
+        }
+        if (slot == 0)
+            return false;
+        in_port->transform_slot[to_index] = slot;
+        transform_held_notes[slot - 1].clear();
+    }
+    else if (route_transforms[slot - 1] == transform) {
+        return true; // the held notes still go through the same chain
+    }
+    else {
+        release_transform_notes(in_port, to_index);
+    }
+    route_transforms[slot - 1] = transform;
+    return true;
+}
+
+void rppicomidi::Midi2usbhub::clear_route_transform(Midi_in_port* in_port, size_t to_index)
+{
+    uint8_t slot = in_port->transform_slot[to_index];
+    if (slot == 0)
+        return;
+    release_transform_notes(in_port, to_index);
+    route_transforms[slot - 1].clear();
+    in_port->transform_slot[to_index] = 0;
+}
+
+void rppicomidi::Midi2usbhub::release_transform_notes(Midi_in_port* in_port, size_t to_index)
+{
+    uint8_t slot = in_port->transform_slot[to_index];
+    auto out_port = out_port_by_index[to_index];
+    if (slot == 0 || out_port == nullptr || !transform_held_notes[slot - 1].any())
+        return;
+    auto& held = transform_held_notes[slot - 1];
+    uint32_t now = time_us_32();
+    held.for_each([&](uint8_t channel, uint8_t note) {
+        Midi_event tx;
+        tx.packet[0] = 0x8; // Note Off
+        tx.packet[1] = 0x80 | channel;
+        tx.packet[2] = note;
+        tx.packet[3] = 0;
+        if (!route_transforms[slot - 1].apply(tx.packet))
+            return;
+        tx.from_devaddr = in_port->devaddr;
+        tx.from_cable = in_port->cable;
+        tx.to_index = to_index;
+        tx.latency_slot = 0;
+        tx.timestamp = now;
+        if (!note_off_pool.push_back(note_off_list, tx))
+            count_drop(out_port, tx.packet);
+    });
+    held.clear();
+#if MIDI2USBHUB_DUAL_CORE
+    // wake the routing core to send them
+    __sev();
+#endif
+}
+
+void rppicomidi::Midi2usbhub::service_transform_note_offs()
+{
+    if (note_off_list.empty())
+        return;
+    Routing_lock lock(&routing_lock);
+    uint32_t now = time_us_32();
+    Midi_event* note_off;
+    while ((note_off = note_off_pool.front(note_off_list)) != nullptr) {
+        Midi_event tx = *note_off;
+        note_off_pool.pop_front(note_off_list);
+        // the ports may have gone away; a route that was disconnected still
+        // turns its notes off
+        auto in_port = in_port_lookup[tx.from_devaddr][tx.from_cable];
+        auto out_port = out_port_by_index[tx.to_index];
+        if (in_port == nullptr || out_port == nullptr)
+            continue;
+        midi_packet::set_cable(tx.packet, out_port->cable);
+        uint16_t delay_ms = in_port->delay_ms[tx.to_index];
+        if (delay_ms != 0)
+            delay_packet(out_port, tx, delay_ms);
+        else
+            merge_packet(in_port, out_port, tx, now);
+    }
+    publish_usb_tx();
+}
+
+void rppicomidi::Midi2usbhub::clear_route_settings(Midi_in_port* in_port, size_t to_index)
+{
+    in_port->delay_ms[to_index] = 0;
+    in_port->filter[to_index] = Route_filter();
+    clear_route_transform(in_port, to_index);
+    if (in_port->zones_slot != 0) {
+        keyboard_zones[in_port->zones_slot - 1].remove_port(to_index);
+        release_empty_zones(in_port);
+    }
+}
+
+int rppicomidi::Midi2usbhub::set_zone(const std::string& from_nickname, uint8_t zone, uint8_t lowest, uint8_t highest,
+                                      const std::vector<std::string>& to_nicknames)
+{
+    for (auto &in_port : midi_in_port_list) {
+        if (in_port->nickname == from_nickname) {
+            Route_mask sends_to;
+            for (auto& to_nickname : to_nicknames) {
+                bool found = false;
+                for (auto out_port : midi_out_port_list) {
+                    if (out_port->nickname == to_nickname && in_port->sends_data_to.test(out_port->index)) {
+                        sends_to.set(out_port->index);
+                        found = true;
+                    }
+                }
+                if (!found)
+                    return -1;
+            }
+            Routing_lock lock(&routing_lock);
+            return store_zone(in_port, zone, lowest, highest, sends_to);
+        }
+    }
+    return -2;
+}
+
+int rppicomidi::Midi2usbhub::remove_zone(const std::string& from_nickname, uint8_t zone)
+{
+    for (auto &in_port : midi_in_port_list) {
+        if (in_port->nickname == from_nickname) {
+            Routing_lock lock(&routing_lock);
+            if (in_port->zones_slot != 0) {
+                auto& zones = keyboard_zones[in_port->zones_slot - 1];
+                if (zone >= Input_zones::max_zones)
+                    zones.remove_zones();
+                else
+                    zones.remove_zone(zone);
+                release_empty_zones(in_port);
+            }
+            return 0;
+        }
+    }
+    return -2;
+}
+
+int rppicomidi::Midi2usbhub::store_zone(Midi_in_port* in_port, uint8_t zone, uint8_t lowest, uint8_t highest, const Route_mask& sends_to)
+{
+    uint8_t slot = in_port->zones_slot;
+    if (slot == 0) {
+        // the entry in_port had last still knows where its held notes went
+        for (size_t idx = 0; idx < MIDI2USBHUB_MAX_ZONED_INPUTS && slot == 0; idx++) {
+            const auto& owner = keyboard_zones_owner[idx];
+            if (!owner.in_use && owner.devaddr == in_port->devaddr && owner.cable == in_port->cable)
+                slot = idx + 1;
+        }
+        for (size_t idx = 0; idx < MIDI2USBHUB_MAX_ZONED_INPUTS && slot == 0; idx++) {
+            if (!keyboard_zones_owner[idx].in_use)
+                slot = idx + 1;
+        }
+        if (slot == 0)
+            return -4;
+    }
+    auto& zones = keyboard_zones[slot - 1];
+    auto& owner = keyboard_zones_owner[slot - 1];
+    if (owner.devaddr != in_port->devaddr || owner.cable != in_port->cable) {
+        zones.clear(); // forget the notes the entry's previous port held
+        owner.devaddr = in_port->devaddr;
+        owner.cable = in_port->cable;
+    }
+    if (!zones.set_zone(zone, lowest, highest, sends_to))
+        return -3;
+    owner.in_use = true;
+    in_port->zones_slot = slot;
+    return 0;
+}
+
+void rppicomidi::Midi2usbhub::release_empty_zones(Midi_in_port* in_port)
+{
+    if (in_port->zones_slot != 0 && keyboard_zones[in_port->zones_slot - 1].empty()) {
+        keyboard_zones_owner[in_port->zones_slot - 1].in_use = false;
+        in_port->zones_slot = 0;
+    }
+}
+
+int rppicomidi::Midi2usbhub::set_route_delay(const std::string& from_nickname, const std::string& to_nickname, uint16_t delay_ms)
+{
+    if (delay_ms > MIDI2USBHUB_MAX_ROUTE_DELAY_MS)
+        return -3;
+    for (auto &in_port : midi_in_port_list) {
+        if (in_port->nickname == from_nickname) {
+            for (auto out_port : midi_out_port_list) {
+                if (out_port->nickname == to_nickname && in_port->sends_data_to.test(out_port->index)) {
+                    Routing_lock lock(&routing_lock);
+                    in_port->delay_ms[out_port->index] = delay_ms;
+                    return 0;
+                }
+            }
+            return -1;
+        }
     }
+    return -2;
 }
 
 int rppicomidi::Midi2usbhub::rename(const std::string& old_nickname, const std::string& new_nickname)
@@ -259,8 +953,6 @@ int rppicomidi::Midi2usbhub::rename(const std::string& old_nickname, const std::
 
 void rppicomidi::Midi2usbhub::blink_led()
 {
-    static absolute_time_t previous_timestamp = {0};
-
     static bool led_state = false;
 
     // This design has no on-board LED
@@ -268,7 +960,7 @@ void rppicomidi::Midi2usbhub::blink_led()
         return;
     absolute_time_t now = get_absolute_time();
 
-    int64_t diff = absolute_time_diff_us(previous_timestamp, now);
+    int64_t diff = absolute_time_diff_us(led_timestamp, now);
     if (diff > 1000000)
     {
     	// Set the LED to the current led_state
@@ -279,46 +971,420 @@ void rppicomidi::Midi2usbhub::blink_led()
         #endif
         // Toggle the led_state & update the timestamp
         led_state = !led_state;
-        previous_timestamp = now;
+        led_timestamp = now;
     }
 }
 
 void rppicomidi::Midi2usbhub::flush_usb_tx()
 {
-    for (auto &out_port : midi_out_port_list)
-    {
-        // Call tuh_midi_stream_flush() once per output port device address
-        if (out_port->devaddr != uart_devaddr &&
-            out_port->cable == 0 &&
-            tuh_midi_configured(out_port->devaddr))
-        {
-            tuh_midi_stream_flush(out_port->devaddr);
-        }
-    }
-}
-
-void rppicomidi::Midi2usbhub::poll_midi_uart_rx()
-{
-    uint8_t rx[48];
-    // Pull any bytes received on the MIDI UART out of the receive buffer and
-    // send them out via USB MIDI on virtual cable 0
-    uint8_t nread = midi_uart_poll_rx_buffer(midi_uart_instance, rx, sizeof(rx));
-    if (nread > 0)
-    {
-        // figure out where to send data from UART MIDI IN
-        for (auto &out_port : uart_midi_in_port.sends_data_to_list)
+    // Write the packets in a queue to the device until the queue is empty or
+    // the device's transmit buffer is full. Return true if the queue is empty.
+    bool popped = false;
+    auto write_queue = [this, &popped](uint8_t devaddr, auto& queue) {
+        Midi_event* tx;
+        auto& flush = usb_flush[devaddr];
+        while ((tx = queue.front()) != nullptr)
         {
-            if (out_port->devaddr != 0 && attached_devices[out_port->devaddr].configured)
+            // Pace the device as its profile says
+            uint32_t now = time_us_32();
+            bool sysex = midi_packet::is_sysex(tx->packet);
+            uint32_t wait_us = flush.pacer.get_wait_us(now);
+            if (sysex && flush.sysex_gap_us != 0)
             {
-                uint32_t nwritten = tuh_midi_stream_write(out_port->devaddr, out_port->cable, rx, nread);
-                if (nwritten != nread)
+                if (flush.sysex_chunk_bytes >= MIDI2USBHUB_USB_FLUSH_BYTES)
                 {
-                    TU_LOG1("Warning: Dropped %lu bytes receiving from UART MIDI In\r\n", nread - nwritten);
+                    // this chunk is full; send it and start the gap
+                    flush.urgent = true;
+                    return false;
                 }
+                uint32_t since_last = now - flush.last_sysex_transfer;
+                if (flush.sysex_chunk_bytes == 0 && since_last < flush.sysex_gap_us && flush.sysex_gap_us - since_last > wait_us)
+                    wait_us = flush.sysex_gap_us - since_last;
             }
-        }
-    }
-}
+            if (wait_us != 0)
+            {
+                flush.paced = true;
+                flush.paced_until = now + wait_us;
+                return false;
+            }
+            if (!tuh_midi_packet_write(devaddr, tx->packet))
+                break;
+            flush.pacer.take(1, now);
+            if (sysex)
+                flush.sysex_chunk_bytes += 4;
+            if (flush.pending_bytes == 0)
+                flush.pending_since = now;
+            flush.pending_bytes += 4;
+            if (midi_packet::is_realtime(tx->packet))
+                flush.urgent = true; // keep MIDI clock steady
+            uint32_t latency = now - tx->timestamp;
+            pipeline_stats.usb_out_latency.add(latency);
+            add_route_latency(tx->latency_slot, latency);
+            auto out_port = out_port_by_index[tx->to_index];
+            if (out_port != nullptr && out_port->devaddr == devaddr)
+            {
+                uint8_t nbytes = midi_packet::get_num_bytes(midi_packet::get_cin(tx->packet));
+                out_port->stats.add(count_messages(tx->packet + 1, nbytes), nbytes, now);
+                if (out_port->fixed_latency_us != 0)
+                {
+                    // the routing core released it on time; send it now
+                    flush.urgent = true;
+                    out_port->add_release_error(latency);
+                }
+            }
+            queue.pop();
+            popped = true;
+        }
+        return queue.empty();
+    };
+    for (uint8_t devaddr = 1; devaddr <= CFG_TUH_DEVICE_MAX; devaddr++)
+    {
+        auto& flush = usb_flush[devaddr];
+        if (!tuh_midi_configured(devaddr))
+        {
+            // the device is gone; anything still queued for it is stale
+            usb_rt_queue[devaddr].clear();
+            usb_tx_queue[devaddr].clear();
+            flush.pending_bytes = 0;
+            flush.urgent = false;
+            flush.waiting = false;
+            flush.paced = false;
+            flush.sysex_chunk_bytes = 0;
+            continue;
+        }
+        // System Real-Time messages such as MIDI clock go ahead of everything else
+        flush.paced = false;
+        bool all_written = write_queue(devaddr, usb_rt_queue[devaddr]) && write_queue(devaddr, usb_tx_queue[devaddr]);
+        if (!all_written && !flush.paced)
+            flush.urgent = true; // the device's OUT buffer is full
+        flush.waiting = false;
+        if (flush.pending_bytes == 0)
+            continue;
+        // In throughput mode, wait for a full transfer or the flush deadline
+        // so that more packets share each bulk transfer
+        bool full = flush.pending_bytes >= MIDI2USBHUB_USB_FLUSH_BYTES;
+        bool expired = time_us_32() - flush.pending_since >= usb_flush_deadline_us;
+        if (flush.get_flush_mode(usb_flush_mode) == Usb_flush_mode::throughput && !flush.urgent && !full && !expired)
+            continue;
+        uint32_t nflushed = tuh_midi_stream_flush(devaddr);
+        if (nflushed == 0)
+        {
+            // The previous transfer is still in progress; its completion
+            // event wakes this core to try again
+            flush.waiting = true;
+            continue;
+        }
+        ++usb_flush_stats.transfers;
+        usb_flush_stats.bytes += nflushed;
+        if (full || flush.urgent)
+            ++usb_flush_stats.full_flushes;
+        else if (expired)
+            ++usb_flush_stats.deadline_flushes;
+        flush.pending_bytes = nflushed < flush.pending_bytes ? flush.pending_bytes - nflushed : 0;
+        flush.pending_since = time_us_32();
+        flush.urgent = false;
+        if (flush.sysex_chunk_bytes != 0)
+        {
+            flush.last_sysex_transfer = flush.pending_since;
+            flush.sysex_chunk_bytes = 0;
+        }
+    }
+    if (popped)
+    {
+        // let the routing core move more packets from the MIDI OUT queues
+        out_queue_refill = true;
+#if MIDI2USBHUB_DUAL_CORE
+        __sev();
+#endif
+    }
+}
+
+bool rppicomidi::Midi2usbhub::transmit_packet(Midi_out_port* out_port, const Midi_event& tx)
+{
+    if (out_port->devaddr == uart_devaddr)
+        return write_uart_tx(tx.packet + 1, midi_packet::get_num_bytes(midi_packet::get_cin(tx.packet)), tx.timestamp, tx.latency_slot);
+    // publish_usb_tx() hands the packets to the USB host core
+    bool staged;
+    if (midi_packet::is_realtime(tx.packet))
+        staged = usb_rt_queue[out_port->devaddr].stage(tx);
+    else
+        staged = usb_tx_queue[out_port->devaddr].stage(tx);
+    if (staged)
+    {
+        usb_tx_staged[out_port->devaddr] = true;
+        out_port->shaper.take(midi_packet::get_num_bytes(midi_packet::get_cin(tx.packet)), time_us_32());
+    }
+    return staged;
+}
+
+void rppicomidi::Midi2usbhub::publish_usb_tx()
+{
+    bool published = false;
+    for (uint8_t devaddr = 1; devaddr <= CFG_TUH_DEVICE_MAX; devaddr++)
+    {
+        if (!usb_tx_staged[devaddr])
+            continue;
+        // Real-Time first so that flush_usb_tx() never sees the rest without it
+        usb_rt_queue[devaddr].publish();
+        usb_tx_queue[devaddr].publish();
+        usb_tx_staged[devaddr] = false;
+        published = true;
+    }
+    if (published)
+        ring_usb_host_doorbell();
+}
+
+void rppicomidi::Midi2usbhub::count_drop(Midi_out_port* out_port, const uint8_t packet[4])
+{
+    out_port->stats.routing_core_drops += count_messages(packet + 1, midi_packet::get_num_bytes(midi_packet::get_cin(packet)));
+    if (out_port->devaddr != uart_devaddr)
+        ++pipeline_stats.usb_tx_dropped;
+    TU_LOG1("Warning: Dropped packet sending to %s\r\n", out_port->nickname.c_str());
+}
+
+void rppicomidi::Midi2usbhub::poll_midi_uart_rx()
+{
+    uint8_t rx[48];
+    Routing_lock lock(&routing_lock);
+    // Each byte makes at most one packet. If a MIDI OUT port that blocks its
+    // sources is full, leave the bytes in the UART receive buffer. Take no
+    // more than the input budget so the USB MIDI devices get their turn.
+    uint16_t room = get_block_source_room(&uart_midi_in_port);
+    uint16_t budget = input_budget * 3 < sizeof(rx) ? input_budget * 3 : sizeof(rx);
+    uint16_t cap = room < budget ? room : budget;
+    // Pull any bytes received on the MIDI UART out of the receive buffer and
+    // route them one complete message at a time
+    uint8_t nread = 0;
+    if (cap != 0 && has_uart_rx_carry)
+    {
+        rx[nread++] = uart_rx_carry;
+        has_uart_rx_carry = false;
+    }
+    if (cap > nread)
+        nread += midi_uart_poll_rx_buffer(midi_uart_instance, rx + nread, cap - nread);
+    uart_rx_active = nread > 0;
+    if (nread > 0)
+    {
+        auto& stats = input_stats[uart_devaddr];
+        ++stats.passes;
+        // midi_uart_lib can't say how many bytes it holds, so take one more
+        // byte to learn if the pass left any behind; the next pass routes it first
+        if (nread == cap && midi_uart_poll_rx_buffer(midi_uart_instance, &uart_rx_carry, 1) == 1)
+        {
+            has_uart_rx_carry = true;
+            ++stats.deferred;
+        }
+        Midi_event event;
+        event.from_devaddr = uart_devaddr;
+        event.from_cable = 0;
+        event.timestamp = time_us_32();
+        if (is_uart_thru_active())
+            write_uart_thru(rx, nread, event.timestamp);
+        // Parse each message once and send the same packet to every destination
+        for (uint8_t idx = 0; idx < nread; idx++)
+        {
+            if (uart_rx_parser.parse(rx[idx], event.packet))
+            {
+                route_packet(&uart_midi_in_port, event);
+                if (uart_rx_parser.get_pending(event.packet))
+                    route_packet(&uart_midi_in_port, event);
+            }
+        }
+        // Each USB device gets the packets from the whole read in one batch
+        publish_usb_tx();
+    }
+}
+
+// 10 bits per byte on the wire
+static const uint32_t uart_byte_time_us = 10 * 1000000 / MIDI_UART_LIB_BAUD_RATE;
+
+bool rppicomidi::Midi2usbhub::write_uart_tx(const uint8_t* bytes, uint8_t nbytes, uint32_t timestamp, uint8_t latency_slot)
+{
+    // The MIDI spec allows System Real-Time bytes between the bytes of any
+    // other message, so send them to midi_uart_lib right away. Queue the rest.
+    uint8_t realtime[nbytes];
+    uint8_t other[nbytes];
+    uint8_t nrealtime = 0;
+    uint8_t nother = 0;
+    for (uint8_t idx = 0; idx < nbytes; idx++)
+    {
+        if (midi_packet::is_realtime_byte(bytes[idx]))
+            realtime[nrealtime++] = bytes[idx];
+        else
+            other[nother++] = bytes[idx];
+    }
+    // Running status can only make the message shorter
+    if (uart_tx_queue.get_capacity() - uart_tx_queue.size() < nother)
+        return false;
+    absolute_time_t now = get_absolute_time();
+    if (absolute_time_diff_us(uart_tx_busy_until, now) > 0)
+        uart_tx_busy_until = now;
+    if (nrealtime != 0)
+    {
+        uint8_t npushed = midi_uart_write_tx_buffer(midi_uart_instance, realtime, nrealtime);
+        uart_tx_busy_until = delayed_by_us(uart_tx_busy_until, npushed * uart_byte_time_us);
+        if (npushed != nrealtime)
+            return false;
+    }
+    uint8_t nencoded = 0;
+    if (nother != 0)
+    {
+        uint8_t encoded[nother];
+        nencoded = uart_tx_encoder.encode(other, nother, encoded);
+        for (uint8_t idx = 0; idx < nencoded; idx++)
+            uart_tx_queue.push(encoded[idx]);
+    }
+    uint32_t now_us = time_us_32();
+    uart_midi_out_port.stats.add(count_messages(bytes, nbytes), nbytes, now_us);
+    uart_midi_out_port.shaper.take(nrealtime + nencoded, now_us);
+    pipeline_stats.uart_out_latency.add(now_us - timestamp);
+    // The message leaves the hub when the UART finishes sending its last byte
+    absolute_time_t done = uart_tx_busy_until;
+    if (nother != 0)
+        done = delayed_by_us(done, uart_tx_queue.size() * uart_byte_time_us);
+    uint32_t done_us = static_cast<uint32_t>(to_us_since_boot(done));
+    add_route_latency(latency_slot, done_us - timestamp);
+    if (uart_midi_out_port.fixed_latency_us != 0)
+    {
+        // The message's release time is when its first byte starts on the wire
+        uint8_t nsent = nother != 0 ? nencoded : nrealtime;
+        uart_midi_out_port.add_release_error(done_us - nsent * uart_byte_time_us - timestamp);
+    }
+    return true;
+}
+
+void rppicomidi::Midi2usbhub::write_uart_thru(uint8_t* bytes, uint8_t nbytes, uint32_t timestamp)
+{
+    uint8_t nwritten = midi_uart_write_tx_buffer(midi_uart_instance, bytes, nbytes);
+    midi_uart_drain_tx_buffer(midi_uart_instance);
+    // a filter or transform can stop thru mode at any time; the encoder
+    // must not rely on a running status these bytes replaced
+    uart_tx_encoder.cancel_running_status();
+    absolute_time_t now = get_absolute_time();
+    if (absolute_time_diff_us(uart_tx_busy_until, now) > 0)
+        uart_tx_busy_until = now;
+    uart_tx_busy_until = delayed_by_us(uart_tx_busy_until, nwritten * uart_byte_time_us);
+    uint32_t now_us = time_us_32();
+    uart_midi_out_port.stats.add(count_messages(bytes, nwritten), nwritten, now_us);
+    uart_midi_out_port.shaper.take(nwritten, now_us);
+    pipeline_stats.uart_out_latency.add(now_us - timestamp);
+    add_route_latency(get_latency_slot(&uart_midi_in_port, uart_midi_out_port.index),
+                      static_cast<uint32_t>(to_us_since_boot(uart_tx_busy_until)) - timestamp);
+    if (nwritten != nbytes)
+    {
+        uart_midi_out_port.stats.routing_core_drops += count_messages(bytes + nwritten, nbytes - nwritten);
+        TU_LOG1("Warning: Dropped %u thru bytes sending to UART MIDI Out\r\n", nbytes - nwritten);
+    }
+}
+
+bool rppicomidi::Midi2usbhub::has_other_uart_out_sources()
+{
+    for (auto in_port : midi_in_port_list) {
+        if (in_port != &uart_midi_in_port && in_port->sends_data_to.test(uart_midi_out_port.index))
+            return true;
+    }
+    return false;
+}
+
+bool rppicomidi::Midi2usbhub::set_uart_thru(bool enabled)
+{
+    Routing_lock lock(&routing_lock);
+    if (enabled && has_other_uart_out_sources())
+        return false;
+    uart_thru = enabled;
+    // the bytes on the wire no longer match the encoder's running status
+    uart_tx_encoder.cancel_running_status();
+    return true;
+}
+
+void rppicomidi::Midi2usbhub::service_uart_tx()
+{
+    absolute_time_t now = get_absolute_time();
+    if (absolute_time_diff_us(uart_tx_busy_until, now) > 0)
+        uart_tx_busy_until = now;
+    uint8_t* byte;
+    while ((byte = uart_tx_queue.front()) != nullptr &&
+           absolute_time_diff_us(now, uart_tx_busy_until) < MIDI2USBHUB_UART_TX_LOOKAHEAD * uart_byte_time_us)
+    {
+        if (midi_uart_write_tx_buffer(midi_uart_instance, byte, 1) != 1)
+            break;
+        uart_tx_queue.pop();
+        uart_tx_busy_until = delayed_by_us(uart_tx_busy_until, uart_byte_time_us);
+    }
+}
+
+absolute_time_t rppicomidi::Midi2usbhub::get_uart_tx_refill_time()
+{
+    return from_us_since_boot(to_us_since_boot(uart_tx_busy_until) - (MIDI2USBHUB_UART_TX_LOOKAHEAD - 1) * uart_byte_time_us);
+}
+
+uint8_t rppicomidi::Midi2usbhub::get_latency_slot(Midi_in_port* in_port, size_t to_index)
+{
+    uint8_t slot = in_port->latency_slot[to_index];
+    if (slot != 0)
+        return slot;
+    for (size_t idx = 0; idx < MIDI2USBHUB_MAX_LATENCY_ROUTES; idx++)
+    {
+        auto& entry = route_latency[idx];
+        if (!entry.in_use)
+        {
+            entry.from_devaddr = in_port->devaddr;
+            entry.from_cable = in_port->cable;
+            entry.to_index = to_index;
+            entry.histogram.reset();
+            entry.in_use = true;
+            in_port->latency_slot[to_index] = idx + 1;
+            return idx + 1;
+        }
+    }
+    ++untracked_route_messages;
+    return 0;
+}
+
+void rppicomidi::Midi2usbhub::release_stale_route_latency()
+{
+    for (size_t idx = 0; idx < MIDI2USBHUB_MAX_LATENCY_ROUTES; idx++)
+    {
+        auto& entry = route_latency[idx];
+        if (!entry.in_use)
+            continue;
+        auto in_port = in_port_lookup[entry.from_devaddr][entry.from_cable];
+        if (in_port != nullptr && in_port->latency_slot[entry.to_index] == idx + 1)
+        {
+            if (in_port->sends_data_to.test(entry.to_index))
+                continue; // the route still exists
+            in_port->latency_slot[entry.to_index] = 0;
+        }
+        entry.in_use = false;
+    }
+}
+
+void rppicomidi::Midi2usbhub::reset_port_stats()
+{
+    for (auto in_port : midi_in_port_list)
+    {
+        in_port->stats.reset();
+    }
+    for (auto out_port : midi_out_port_list)
+    {
+        out_port->stats.reset();
+    }
+}
+
+void rppicomidi::Midi2usbhub::reset_route_latency()
+{
+    for (auto& entry : route_latency)
+    {
+        entry.histogram.reset();
+    }
+    untracked_route_messages = 0;
+}
+
+void rppicomidi::Midi2usbhub::configure_midi_uart()
+{
+    midi_uart_instance = midi_uart_configure(MIDI_UART_NUM, MIDI_UART_TX_GPIO, MIDI_UART_RX_GPIO);
+    printf("Configured MIDI UART %u for 31250 baud\r\n", MIDI_UART_NUM);
+}
 
 rppicomidi::Midi2usbhub::Midi2usbhub() : cli{&preset_manager}
 {
@@ -333,19 +1399,93 @@ rppicomidi::Midi2usbhub::Midi2usbhub() : cli{&preset_manager}
     // Map the pins to functions
     gpio_init(LED_GPIO);
     gpio_set_dir(LED_GPIO, GPIO_OUT);
-    midi_uart_instance = midi_uart_configure(MIDI_UART_NUM, MIDI_UART_TX_GPIO, MIDI_UART_RX_GPIO);
-    printf("Configured MIDI UART %u for 31250 baud\r\n", MIDI_UART_NUM);
+    // Use a lock of our own so the routing lock can be held while the
+    // ring buffer library takes its locks
+    critical_section_init_with_lock_num(&routing_lock, spin_lock_claim_unused(true));
+    for (auto& pending : usb_rx_pending) {
+        pending = false;
+    }
+    for (auto& staged : usb_tx_staged) {
+        staged = false;
+    }
+    next_usb_rx_devaddr = 1;
+    input_budget = MIDI2USBHUB_INPUT_BUDGET;
+    reset_input_stats();
+    pipeline_stats.reset();
+    for (auto& flush : usb_flush)
+    {
+        flush.pending_bytes = 0;
+        flush.pending_since = 0;
+        flush.urgent = false;
+        flush.waiting = false;
+        flush.paced = false;
+        flush.sysex_gap_us = 0;
+        flush.sysex_chunk_bytes = 0;
+        flush.last_sysex_transfer = 0;
+        flush.use_flush_mode = false;
+    }
+    usb_flush_mode = Usb_flush_mode::latency;
+    usb_flush_deadline_us = MIDI2USBHUB_USB_FLUSH_DEADLINE_US;
+    usb_flush_stats.reset();
+    sysex_locked_ports.clear();
+    out_queue_pending.clear();
+    sysex_timeout_ms = MIDI2USBHUB_SYSEX_TIMEOUT_MS;
+    releasing_held_packets = false;
+    for (auto& entry : route_latency)
+    {
+        entry.in_use = false;
+    }
+    untracked_route_messages = 0;
+    for (auto& owner : keyboard_zones_owner)
+    {
+        owner.in_use = false;
+        owner.devaddr = 0;
+        owner.cable = 0;
+    }
+    console_rx_pending = false;
+    console_rx_time = 0;
+    usb_host_doorbell = false;
+    usb_host_doorbell_time = 0;
+    uart_rx_active = false;
+    has_uart_rx_carry = false;
+    uart_rx_carry = 0;
+    uart_thru = false;
+    usb_rx_blocked = false;
+    out_queue_refill = false;
+    out_queue_throttled = false;
+    uart_tx_busy_until = get_absolute_time();
+    led_timestamp = get_absolute_time();
+    idle_stats[0].reset();
+    idle_stats[1].reset();
+#if MIDI2USBHUB_IDLE_WFE
+    // Wake on any interrupt that becomes pending, even one that arrives
+    // between the check for pending work and the WFE instruction
+    scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS;
+    stdio_set_chars_available_callback(console_chars_available_cb, this);
+#endif
+#if MIDI2USBHUB_DUAL_CORE
+    // The routing core owns the MIDI UART so its interrupts run on that core
+    midi_uart_instance = nullptr;
+#else
+    configure_midi_uart();
+#endif
     while (getchar_timeout_us(0) != PICO_ERROR_TIMEOUT)
     {
         // flush out the console input buffer
     }
     uart_midi_in_port.cable = 0;
     uart_midi_in_port.devaddr = uart_devaddr;
-    uart_midi_in_port.sends_data_to_list.clear();
+    uart_midi_in_port.sends_data_to.clear();
     uart_midi_in_port.nickname = "MIDI-IN-A";
     uart_midi_out_port.cable = 0;
     uart_midi_out_port.devaddr = uart_devaddr;
     uart_midi_out_port.nickname = "MIDI-OUT-A";
+    // 10 bits per byte on the wire
+    uart_midi_out_port.shaper.configure(MIDI_UART_LIB_BAUD_RATE / 10, MIDI2USBHUB_UART_WIRE_BURST_BYTES, time_us_32());
+    for (auto& out_port : out_port_by_index) {
+        out_port = nullptr;
+    }
+    assign_out_port_index(&uart_midi_out_port);
     attached_devices[uart_devaddr].vid = 0;
     attached_devices[uart_devaddr].pid = 0;
     attached_devices[uart_devaddr].product_name = "MIDI A";
@@ -354,6 +1494,8 @@ rppicomidi::Midi2usbhub::Midi2usbhub() : cli{&preset_manager}
     attached_devices[uart_devaddr].configured = true;
     midi_in_port_list.push_back(&uart_midi_in_port);
     midi_out_port_list.push_back(&uart_midi_out_port);
+    rebuild_in_port_lookup();
+    load_device_profiles();
     printf("Cli is running.\r\n");
     printf("Type \"help\" for a list of commands\r\n");
     printf("Use backspace and tab to remove chars and autocomplete\r\n");
@@ -417,15 +1559,225 @@ static void print_utf16(uint16_t *temp_buf, size_t buf_len) {
 
 void rppicomidi::Midi2usbhub::task()
 {
+    // Clear the event flags before doing the work so that events that
+    // happen during this pass set them again
+    console_rx_pending = false;
+    usb_host_doorbell = false;
     tuh_task();
+    // Visit the devices round-robin so each gets to go first in turn
+    for (uint8_t count = 0; count < CFG_TUH_DEVICE_MAX; count++)
+    {
+        uint8_t devaddr = (next_usb_rx_devaddr + count - 1) % CFG_TUH_DEVICE_MAX + 1;
+        if (usb_rx_pending[devaddr])
+            read_usb_rx(devaddr);
+    }
+    next_usb_rx_devaddr = next_usb_rx_devaddr % CFG_TUH_DEVICE_MAX + 1;
+
+#if !MIDI2USBHUB_DUAL_CORE
+    routing_task();
+#endif
+    flush_usb_tx();
 
     blink_led();
 
-    poll_midi_uart_rx();
-    flush_usb_tx();
+    cli.task();
+}
+
+void rppicomidi::Midi2usbhub::routing_task()
+{
+    // Serial port MIDI thru bytes go before everything else. Read the
+    // serial port MIDI IN once per pass either way so it keeps one input budget.
+    bool uart_rx_first = is_uart_thru_active();
+    if (uart_rx_first)
+        poll_midi_uart_rx();
+    route_usb_rx();
+    if (!uart_rx_first)
+        poll_midi_uart_rx();
+    service_sysex_timeouts();
+    service_transform_note_offs();
+    service_delay_lines();
+    service_out_queues();
+    service_uart_tx();
     midi_uart_drain_tx_buffer(midi_uart_instance);
+    uart_tx_encoder.task();
+}
 
-    cli.task();
+#if MIDI2USBHUB_DUAL_CORE
+void rppicomidi::Midi2usbhub::routing_core_main()
+{
+    // Let core 0 pause this core while it writes flash
+    multicore_lockout_victim_init();
+#if MIDI2USBHUB_IDLE_WFE
+    // SCR is a per-core register
+    scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS;
+#endif
+    auto& hub = instance();
+    hub.configure_midi_uart();
+    Routing_core_lockout::routing_core_running = true;
+    while (1) {
+        hub.routing_task();
+        hub.idle_routing_core();
+    }
+}
+#endif
+
+void rppicomidi::Midi2usbhub::console_chars_available_cb(void* param)
+{
+    auto me = reinterpret_cast<Midi2usbhub*>(param);
+    me->console_rx_time = time_us_32();
+    me->console_rx_pending = true;
+}
+
+void rppicomidi::Midi2usbhub::ring_usb_host_doorbell()
+{
+    usb_host_doorbell_time = time_us_32();
+    usb_host_doorbell = true;
+#if MIDI2USBHUB_DUAL_CORE
+    __sev();
+#endif
+}
+
+bool rppicomidi::Midi2usbhub::usb_host_core_has_work()
+{
+    if (tuh_task_event_ready() || console_rx_pending || usb_host_doorbell || get_usb_flush_wait_us() == 0)
+        return true;
+    for (uint8_t devaddr = 1; devaddr <= CFG_TUH_DEVICE_MAX; devaddr++)
+    {
+        if (usb_rx_pending[devaddr])
+            return true;
+    }
+    return false;
+}
+
+uint32_t rppicomidi::Midi2usbhub::get_usb_flush_wait_us()
+{
+    uint32_t wait_us = UINT32_MAX;
+    uint32_t now = time_us_32();
+    for (uint8_t devaddr = 1; devaddr <= CFG_TUH_DEVICE_MAX; devaddr++)
+    {
+        auto& flush = usb_flush[devaddr];
+        if (flush.paced)
+        {
+            // packets wait for the device's pacing
+            int32_t paced_us = static_cast<int32_t>(flush.paced_until - now);
+            if (paced_us <= 0)
+                return 0;
+            if (static_cast<uint32_t>(paced_us) < wait_us)
+                wait_us = paced_us;
+        }
+        if (flush.pending_bytes == 0 || flush.waiting)
+            continue;
+        if (flush.get_flush_mode(usb_flush_mode) == Usb_flush_mode::latency || flush.urgent || flush.pending_bytes >= MIDI2USBHUB_USB_FLUSH_BYTES)
+            return 0;
+        uint32_t elapsed = now - flush.pending_since;
+        if (elapsed >= usb_flush_deadline_us)
+            return 0;
+        if (usb_flush_deadline_us - elapsed < wait_us)
+            wait_us = usb_flush_deadline_us - elapsed;
+    }
+    return wait_us;
+}
+
+bool rppicomidi::Midi2usbhub::routing_core_has_work()
+{
+    // The UART MIDI IN interrupt wakes the core when new bytes arrive
+    return (!usb_rx_queue.empty() && !usb_rx_blocked) || uart_rx_active || out_queue_refill ||
+        (!uart_tx_queue.empty() && time_reached(get_uart_tx_refill_time())) ||
+        (out_queue_throttled && time_reached(out_queue_throttled_until)) ||
+        (!delay_wheel.empty() && get_delay_tick() != delay_wheel.get_tick()) || !note_off_list.empty();
+}
+
+uint32_t rppicomidi::Midi2usbhub::wait_for_event(Idle_stats& stats, absolute_time_t deadline)
+{
+    uint32_t start = time_us_32();
+    best_effort_wfe_or_timeout(deadline);
+    uint32_t now = time_us_32();
+    stats.idle_us += now - start;
+    ++stats.sleeps;
+    return now;
+}
+
+absolute_time_t rppicomidi::Midi2usbhub::get_routing_core_deadline()
+{
+    absolute_time_t deadline = make_timeout_time_ms(1000);
+    // keep the UART MIDI OUT transmit buffer draining and the statistics current
+    absolute_time_t uart_deadline = uart_tx_queue.empty() ? uart_tx_busy_until : get_uart_tx_refill_time();
+    if (absolute_time_diff_us(get_absolute_time(), uart_deadline) > 0)
+        deadline = uart_deadline;
+    // check for SysEx timeouts often enough to keep them accurate
+    if (sysex_locked_ports.any())
+    {
+        absolute_time_t sysex_deadline = make_timeout_time_ms(10);
+        if (absolute_time_diff_us(sysex_deadline, deadline) > 0)
+            deadline = sysex_deadline;
+    }
+    // send more from a rate limited MIDI OUT queue when the rate allows
+    if (out_queue_throttled && absolute_time_diff_us(out_queue_throttled_until, deadline) > 0)
+        deadline = out_queue_throttled_until;
+    // wake every tick while a route delay line has packets waiting
+    if (!delay_wheel.empty())
+    {
+        absolute_time_t tick_deadline = from_us_since_boot(static_cast<uint64_t>(get_delay_tick() + 1) * delay_tick_us);
+        if (absolute_time_diff_us(tick_deadline, deadline) > 0)
+            deadline = tick_deadline;
+    }
+    return deadline;
+}
+
+void rppicomidi::Midi2usbhub::idle_usb_host_core()
+{
+#if MIDI2USBHUB_IDLE_WFE
+    if (usb_host_core_has_work())
+        return;
+    // wake up in time to blink the LED
+    absolute_time_t deadline = delayed_by_us(led_timestamp, 1000001);
+    // and in time to start a USB transfer that is waiting for more packets
+    uint32_t flush_wait_us = get_usb_flush_wait_us();
+    if (flush_wait_us != UINT32_MAX)
+    {
+        absolute_time_t flush_deadline = make_timeout_time_us(flush_wait_us);
+        if (absolute_time_diff_us(flush_deadline, deadline) > 0)
+            deadline = flush_deadline;
+    }
+#if !MIDI2USBHUB_DUAL_CORE
+    if (routing_core_has_work())
+        return;
+    absolute_time_t routing_deadline = get_routing_core_deadline();
+    if (absolute_time_diff_us(routing_deadline, deadline) > 0)
+        deadline = routing_deadline;
+#endif
+    uint32_t now = wait_for_event(idle_stats[0], deadline);
+    if (console_rx_pending)
+        idle_stats[0].wake_latency.add(now - console_rx_time);
+    else if (usb_host_doorbell)
+        idle_stats[0].wake_latency.add(now - usb_host_doorbell_time);
+#if !MIDI2USBHUB_DUAL_CORE
+    else if (!usb_rx_queue.empty())
+        idle_stats[0].wake_latency.add(now - usb_rx_queue.front()->timestamp);
+#endif
+#endif
+}
+
+void rppicomidi::Midi2usbhub::idle_routing_core()
+{
+#if MIDI2USBHUB_IDLE_WFE && MIDI2USBHUB_DUAL_CORE
+    if (routing_core_has_work())
+        return;
+    uint32_t now = wait_for_event(idle_stats[1], get_routing_core_deadline());
+    Midi_event* rx = usb_rx_queue.front();
+    if (rx != nullptr)
+        idle_stats[1].wake_latency.add(now - rx->timestamp);
+#endif
+}
+
+void rppicomidi::Midi2usbhub::launch_routing_core()
+{
+#if MIDI2USBHUB_DUAL_CORE
+    multicore_launch_core1(routing_core_main);
+    while (!Routing_core_lockout::routing_core_running) {
+        tight_loop_contents();
+    }
+#endif
 }
 
 // Main loop
@@ -438,8 +1790,10 @@ int main()
         return -1;
     }
 #endif
+    instance.launch_routing_core();
     while (1) {
         instance.task();
+        instance.idle_usb_host_core();
     }
 }
 
@@ -506,6 +1860,7 @@ void rppicomidi::Midi2usbhub::prod_str_cb(tuh_xfer_t *xfer)
         if (current.length() < 1 || !instance().preset_manager.load_preset(current)) {
             printf("current preset load failed.\r\n");
         }
+        instance().apply_device_profile(xfer->daddr);
         devinfo->configured = true;
     }
 }
@@ -526,21 +1881,47 @@ void rppicomidi::Midi2usbhub::tuh_midi_mount_cb(uint8_t dev_addr, uint8_t in_ep,
     TU_LOG2("MIDI device address = %u, IN endpoint %u has %u cables, OUT endpoint %u has %u cables\r\n",
             dev_addr, in_ep & 0xf, num_cables_rx, out_ep & 0xf, num_cables_tx);
     // As many MIDI IN ports and MIDI OUT ports as required
+    std::vector<Midi_in_port *> new_in_ports;
+    std::vector<Midi_out_port *> new_out_ports;
     for (uint8_t cable = 0; cable < num_cables_rx; cable++)
     {
         auto port = new Midi_in_port;
         port->cable = cable;
         port->devaddr = dev_addr;
 
-        midi_in_port_list.push_back(port);
+        new_in_ports.push_back(port);
     }
     for (uint8_t cable = 0; cable < num_cables_tx; cable++)
     {
         auto port = new Midi_out_port;
         port->cable = cable;
         port->devaddr = dev_addr;
+        port->shaper.configure(MIDI2USBHUB_USB_WIRE_BYTES_PER_SECOND, MIDI2USBHUB_USB_WIRE_BURST_BYTES, time_us_32());
 
-        midi_out_port_list.push_back(port);
+        new_out_ports.push_back(port);
+    }
+    midi_in_port_list.reserve(midi_in_port_list.size() + new_in_ports.size());
+    midi_out_port_list.reserve(midi_out_port_list.size() + new_out_ports.size());
+    std::vector<Midi_out_port *> no_room;
+    {
+        Routing_lock lock(&routing_lock);
+        for (auto port : new_in_ports)
+        {
+            midi_in_port_list.push_back(port);
+        }
+        for (auto port : new_out_ports)
+        {
+            if (assign_out_port_index(port))
+                midi_out_port_list.push_back(port);
+            else
+                no_room.push_back(port);
+        }
+        rebuild_in_port_lookup();
+    }
+    for (auto port : no_room)
+    {
+        printf("No room for MIDI OUT port %u of device %u\r\n", port->cable + 1, dev_addr);
+        delete port;
     }
 }
 
@@ -568,53 +1949,74 @@ void tuh_mount_cb(uint8_t dev_addr)
 // Invoked when device with MIDI interface is un-mounted
 void rppicomidi::Midi2usbhub::tuh_midi_unmount_cb(uint8_t dev_addr, uint8_t)
 {
-    for (std::vector<Midi_in_port *>::iterator it = midi_in_port_list.begin(); it != midi_in_port_list.end();)
+    // Unlink the device's ports while the routing core can't use them,
+    // then free them after
+    std::vector<Midi_in_port *> old_in_ports;
+    std::vector<Midi_out_port *> old_out_ports;
+    old_in_ports.reserve(midi_in_port_list.size());
+    old_out_ports.reserve(midi_out_port_list.size());
     {
-        if ((*it)->devaddr == dev_addr)
-        {
-            delete (*it);
-            midi_in_port_list.erase(it);
-        }
-        else
+        Routing_lock lock(&routing_lock);
+        for (std::vector<Midi_in_port *>::iterator it = midi_in_port_list.begin(); it != midi_in_port_list.end();)
         {
-            // remove all reference to the device address in existing sends_data_to_list elements
-            for (std::vector<Midi_out_port *>::iterator jt = (*it)->sends_data_to_list.begin(); jt != (*it)->sends_data_to_list.end();)
+            if ((*it)->devaddr == dev_addr)
             {
-                if ((*jt)->devaddr == dev_addr)
+                for (size_t idx = 0; idx < max_out_ports; idx++)
                 {
-                    (*it)->sends_data_to_list.erase(jt);
+                    clear_route_settings(*it, idx);
                 }
-                else
+                purge_merge_state(*it, nullptr);
+                // a port of the next device at dev_addr must not get the held notes
+                for (auto& owner : keyboard_zones_owner)
                 {
-                    ++jt;
+                    if (owner.devaddr == dev_addr)
+                        owner.devaddr = 0;
                 }
+                old_in_ports.push_back(*it);
+                it = midi_in_port_list.erase(it);
+            }
+            else
+            {
+                ++it;
             }
-            ++it;
         }
-    }
 
-    for (std::vector<Midi_out_port *>::iterator it = uart_midi_in_port.sends_data_to_list.begin(); it != uart_midi_in_port.sends_data_to_list.end();)
-    {
-        if ((*it)->devaddr == dev_addr)
-        {
-            uart_midi_in_port.sends_data_to_list.erase(it);
-        }
-        else
+        for (std::vector<Midi_out_port *>::iterator it = midi_out_port_list.begin(); it != midi_out_port_list.end();)
         {
-            ++it;
+            if ((*it)->devaddr == dev_addr)
+            {
+                // remove all routes to the port and free its index
+                for (auto &midi_in : midi_in_port_list)
+                {
+                    midi_in->sends_data_to.reset((*it)->index);
+                    clear_route_settings(midi_in, (*it)->index);
+                }
+                purge_merge_state(nullptr, *it);
+                out_port_by_index[(*it)->index] = nullptr;
+                old_out_ports.push_back(*it);
+                it = midi_out_port_list.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
         }
+
+        rebuild_in_port_lookup();
+        release_stale_route_latency();
     }
-    for (std::vector<Midi_out_port *>::iterator it = midi_out_port_list.begin(); it != midi_out_port_list.end();)
+    for (auto port : old_in_ports)
     {
-        if ((*it)->devaddr == dev_addr)
-        {
-            delete (*it);
-            midi_out_port_list.erase(it);
-        }
-        else
-        {
-            ++it;
-        }
+        delete port;
+    }
+    for (auto port : old_out_ports)
+    {
+        delete port;
+    }
+    if (dev_addr <= CFG_TUH_DEVICE_MAX)
+    {
+        usb_rx_pending[dev_addr] = false;
+        input_stats[dev_addr].reset();
     }
 
     attached_devices[dev_addr].configured = false;
@@ -632,45 +2034,551 @@ void tuh_midi_umount_cb(uint8_t dev_addr, uint8_t instance)
 
 void rppicomidi::Midi2usbhub::tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets)
 {
-    if (num_packets != 0)
+    // task() reads the packets so that no one device can hog the loop
+    if (num_packets != 0 && dev_addr <= CFG_TUH_DEVICE_MAX)
+    {
+        usb_rx_pending[dev_addr] = true;
+    }
+}
+
+void rppicomidi::Midi2usbhub::read_usb_rx(uint8_t dev_addr)
+{
+    Midi_event rx;
+    rx.from_devaddr = dev_addr;
+    usb_rx_pending[dev_addr] = false;
+    uint16_t nread = 0;
+    while (nread < input_budget)
     {
-        uint8_t cable_num;
-        uint8_t buffer[48];
-        while (1)
+        if (usb_rx_queue.get_capacity() - usb_rx_queue.size() == 0)
         {
-            uint32_t bytes_read = tuh_midi_stream_read(dev_addr, &cable_num, buffer, sizeof(buffer));
-            if (bytes_read == 0)
+            // Leave the rest in the USB host driver's buffer until the routing core catches up
+            usb_rx_pending[dev_addr] = true;
+            ++pipeline_stats.usb_rx_queue_full;
+            break;
+        }
+        if (!tuh_midi_packet_read(dev_addr, rx.packet))
+            break;
+        rx.from_cable = midi_packet::get_cable(rx.packet);
+        rx.timestamp = time_us_32();
+        usb_rx_queue.push(rx);
+        ++nread;
+    }
+    if (nread == input_budget)
+    {
+        // Let the other sources have a turn before reading more
+        usb_rx_pending[dev_addr] = true;
+        ++input_stats[dev_addr].deferred;
+    }
+    if (nread != 0)
+    {
+        ++input_stats[dev_addr].passes;
+#if MIDI2USBHUB_DUAL_CORE
+        __sev(); // wake the routing core
+#endif
+    }
+}
+
+void rppicomidi::Midi2usbhub::route_usb_rx()
+{
+    Midi_event* rx;
+    usb_rx_blocked = false;
+    // task() reads at most input_budget packets from each device per pass,
+    // so this is one pass worth from every device. The serial port MIDI IN
+    // gets its turn before the rest.
+    uint32_t budget = input_budget * CFG_TUH_DEVICE_MAX;
+    if (usb_rx_queue.front() == nullptr)
+        return;
+    Routing_lock lock(&routing_lock);
+    while (budget-- > 0 && (rx = usb_rx_queue.front()) != nullptr)
+    {
+        uint8_t* packet = rx->packet;
+        uint8_t cin = midi_packet::get_cin(packet);
+        uint8_t nbytes = midi_packet::get_num_bytes(cin);
+        if (nbytes != 0) // else reserved CIN; nothing to route
+        {
+            // Route the packet to the correct MIDI OUT port
+            auto in_port = in_port_lookup[rx->from_devaddr][rx->from_cable];
+            if (in_port != nullptr)
+            {
+                // Leave the packet in the queue if a MIDI OUT port that
+                // blocks its sources is full. The queue will back up to
+                // the USB host driver, which then stops reading the device.
+                if (get_block_source_room(in_port) == 0)
+                {
+                    usb_rx_blocked = true;
+                    break;
+                }
+                input_stats[rx->from_devaddr].wait.add(time_us_32() - rx->timestamp);
+                route_packet(in_port, *rx);
+            }
+        }
+        usb_rx_queue.pop();
+    }
+    // Each USB device gets the packets from the whole pass in one batch
+    publish_usb_tx();
+}
+
+void rppicomidi::Midi2usbhub::route_packet(Midi_in_port* in_port, const Midi_event& event)
+{
+    uint8_t nbytes = midi_packet::get_num_bytes(midi_packet::get_cin(event.packet));
+    in_port->stats.add(count_messages(event.packet + 1, nbytes), nbytes, event.timestamp);
+    uint32_t now = time_us_32();
+    // resolve the keyboard zone target once per message; it also tracks the held notes
+    Input_zones* zones = nullptr;
+    uint8_t zone_target = 0;
+    if (in_port->zones_slot != 0 && Input_zones::is_note_message(event.packet)) {
+        zones = &keyboard_zones[in_port->zones_slot - 1];
+        zone_target = zones->resolve(event.packet);
+    }
+    in_port->sends_data_to.for_each([&](size_t idx) {
+        auto out_port = out_port_by_index[idx];
+        // write_uart_thru() already sent the bytes of a serial port MIDI thru
+        if (in_port == &uart_midi_in_port && out_port == &uart_midi_out_port && is_uart_thru_active())
+            return;
+        // notes only go to the MIDI OUT ports of their keyboard zone
+        if (zones != nullptr && !zones->sends_to(zone_target, idx))
+            return;
+        // filtered messages never take room in a MIDI OUT queue
+        if (!in_port->filter[idx].passes(event.packet))
+            return;
+        // forward the event as is except for the destination, the cable number and the transform
+        Midi_event tx = event;
+        uint8_t transform_slot = in_port->transform_slot[idx];
+        if (transform_slot != 0) {
+            // remember the notes the transform turns on in case it changes before they end
+            transform_held_notes[transform_slot - 1].track(event.packet);
+            if (!route_transforms[transform_slot - 1].apply(tx.packet))
                 return;
-            // Route the MIDI stream to the correct MIDI OUT port
-            for (auto &in_port : midi_in_port_list)
+        }
+        midi_packet::set_cable(tx.packet, out_port->cable);
+        tx.latency_slot = get_latency_slot(in_port, idx);
+        tx.to_index = idx;
+        uint16_t delay_ms = in_port->delay_ms[idx];
+        if (delay_ms != 0)
+            delay_packet(out_port, tx, delay_ms);
+        else
+            merge_packet(in_port, out_port, tx, now);
+    });
+}
+
+void rppicomidi::Midi2usbhub::delay_packet(Midi_out_port* out_port, Midi_event& tx, uint16_t delay_ms)
+{
+    tx.timestamp += delay_ms * 1000ul;
+    // Release the packet at the first tick at or after the time it is due
+    uint64_t now = time_us_64();
+    int32_t wait_us = static_cast<int32_t>(tx.timestamp - static_cast<uint32_t>(now));
+    uint64_t due = wait_us > 0 ? now + wait_us : now;
+    uint32_t due_tick = static_cast<uint32_t>((due + delay_tick_us - 1) / delay_tick_us);
+    // Packets that came due while the routing core was busy go out first
+    uint32_t now_us = static_cast<uint32_t>(now);
+    bool scheduled = delay_wheel.schedule(tx, due_tick, static_cast<uint32_t>(now / delay_tick_us), [&](const Midi_event& due_tx) {
+        release_delayed_packet(due_tx, now_us);
+    });
+    if (!scheduled)
+        count_drop(out_port, tx.packet);
+}
+
+void rppicomidi::Midi2usbhub::service_delay_lines()
+{
+    if (delay_wheel.empty())
+        return;
+    uint32_t now_tick = get_delay_tick();
+    if (now_tick == delay_wheel.get_tick())
+        return;
+    Routing_lock lock(&routing_lock);
+    uint32_t now = time_us_32();
+    delay_wheel.advance(now_tick, [&](const Midi_event& tx) {
+        release_delayed_packet(tx, now);
+    });
+    publish_usb_tx();
+}
+
+void rppicomidi::Midi2usbhub::release_delayed_packet(const Midi_event& tx, uint32_t now)
+{
+    // the route may have gone away while the packet waited
+    auto in_port = in_port_lookup[tx.from_devaddr][tx.from_cable];
+    auto out_port = out_port_by_index[tx.to_index];
+    if (in_port != nullptr && out_port != nullptr && in_port->sends_data_to.test(tx.to_index))
+        merge_packet(in_port, out_port, tx, now);
+}
+
+void rppicomidi::Midi2usbhub::send_packet(Midi_out_port* out_port, const Midi_event& tx)
+{
+    // In fixed latency mode, Real-Time messages such as MIDI Clock wait
+    // for their release time too so they keep their spacing
+    if (!midi_packet::is_realtime(tx.packet) || out_port->fixed_latency_us != 0)
+        queue_out_packet(out_port, tx);
+    else if (!transmit_packet(out_port, tx))
+        count_drop(out_port, tx.packet);
+}
+
+bool rppicomidi::Midi2usbhub::make_out_queue_room(Midi_out_port* out_port)
+{
+    auto& queue = out_port->queue;
+    if (queue.packets.count < queue.depth && out_pool.get_num_free() != 0)
+        return true;
+    if (queue.policy != Overflow_policy::drop_oldest)
+        return false;
+    // Never split a SysEx message to make room
+    Midi_event dropped;
+    bool removed = out_pool.remove_first_if(queue.packets, [&](const Midi_event& tx) {
+        if (midi_packet::is_sysex(tx.packet))
+            return false;
+        dropped = tx;
+        return true;
+    });
+    if (!removed)
+        return false;
+    count_drop(out_port, dropped.packet);
+    return out_pool.get_num_free() != 0;
+}
+
+void rppicomidi::Midi2usbhub::queue_out_packet(Midi_out_port* out_port, const Midi_event& tx)
+{
+    auto& queue = out_port->queue;
+    bool sysex = midi_packet::is_sysex(tx.packet);
+    bool sysex_end = midi_packet::is_sysex_end(tx.packet);
+    if (queue.dropping_sysex)
+    {
+        if (sysex)
+        {
+            // the rest of a SysEx message that did not fit
+            queue.dropping_sysex = !sysex_end;
+            count_drop(out_port, tx.packet);
+            return;
+        }
+        // a Real-Time message may come in the middle of the SysEx message
+        if (!midi_packet::is_realtime(tx.packet))
+            queue.dropping_sysex = false;
+    }
+    if (queue.needs_eox)
+    {
+        // end the SysEx message that was cut short before anything else goes out
+        if (!make_out_queue_room(out_port))
+        {
+            count_drop(out_port, tx.packet);
+            if (sysex && !sysex_end)
+                queue.dropping_sysex = true;
+            return;
+        }
+        Midi_event eox = tx;
+        eox.packet[0] = (tx.packet[0] & 0xF0) | 0x5; // SysEx ends with the following single byte
+        eox.packet[1] = 0xF7;
+        eox.packet[2] = 0;
+        eox.packet[3] = 0;
+        eox.latency_slot = 0;
+        out_pool.push_back(queue.packets, eox);
+        queue.needs_eox = false;
+    }
+    // A queue that only waits for its fixed latency release times is not behind
+    if (queue.thin && queue.behind && !queue.packets.empty())
+        thin_out_queue(out_port, tx);
+    if (make_out_queue_room(out_port))
+    {
+        out_pool.push_back(queue.packets, tx);
+        if (queue.packets.count > queue.high_water)
+            queue.high_water = queue.packets.count;
+        if (sysex)
+            queue.sysex_open = !sysex_end;
+        out_queue_pending.set(out_port->index);
+        return;
+    }
+    // drop the new message without splitting it
+    count_drop(out_port, tx.packet);
+    if (sysex)
+    {
+        if (!sysex_end)
+            queue.dropping_sysex = true;
+        if (queue.sysex_open)
+        {
+            // part of the message is already on its way
+            queue.needs_eox = true;
+            queue.sysex_open = false;
+            out_queue_pending.set(out_port->index);
+        }
+    }
+}
+
+void rppicomidi::Midi2usbhub::thin_out_queue(Midi_out_port* out_port, const Midi_event& tx)
+{
+    out_port->queue.thinned += out_queue_rules::thin_packets(out_pool, out_port->queue.packets, tx.packet);
+}
+
+uint16_t rppicomidi::Midi2usbhub::get_block_source_room(Midi_in_port* in_port)
+{
+    uint16_t room = UINT16_MAX;
+    in_port->sends_data_to.for_each([&](size_t idx) {
+        auto out_port = out_port_by_index[idx];
+        auto& queue = out_port->queue;
+        if (queue.policy != Overflow_policy::block_source)
+            return;
+        uint16_t port_room = queue.packets.count < queue.depth ? queue.depth - queue.packets.count : 0;
+        if (port_room > out_pool.get_num_free())
+            port_room = out_pool.get_num_free();
+        // leave room for End of SysEx
+        if (port_room > 0 && queue.needs_eox)
+            --port_room;
+        if (port_room == 0)
+            ++queue.blocked;
+        if (port_room < room)
+            room = port_room;
+    });
+    return room;
+}
+
+void rppicomidi::Midi2usbhub::service_out_queues()
+{
+    out_queue_refill = false;
+    out_queue_throttled = false;
+    if (!out_queue_pending.any())
+        return;
+    bool sent = false;
+    uint32_t now = time_us_32();
+    uint32_t throttle_us = UINT32_MAX;
+    Routing_lock lock(&routing_lock);
+    out_queue_pending.for_each([&](size_t idx) {
+        auto out_port = out_port_by_index[idx];
+        auto& queue = out_port->queue;
+        if (queue.needs_eox && queue.packets.count < queue.depth && out_pool.get_num_free() != 0)
+        {
+            Midi_event eox;
+            eox.packet[0] = 0x5; // SysEx ends with the following single byte
+            midi_packet::set_cable(eox.packet, out_port->cable);
+            eox.packet[1] = 0xF7;
+            eox.packet[2] = 0;
+            eox.packet[3] = 0;
+            eox.from_devaddr = 0;
+            eox.from_cable = 0;
+            eox.latency_slot = 0;
+            eox.to_index = idx;
+            eox.timestamp = time_us_32();
+            out_pool.push_back(queue.packets, eox);
+            queue.needs_eox = false;
+        }
+        Midi_event* tx;
+        queue.behind = false;
+        while ((tx = out_pool.front(queue.packets)) != nullptr)
+        {
+            // In fixed latency mode, hold the message until its release time.
+            // The routing core's idle timer wakes it up in time. While the
+            // port is over its wire rate, hold the rest in the queue and let
+            // the queue's overflow policy decide what to drop.
+            uint32_t wait_us = 0;
+            auto release = out_queue_rules::get_release(tx->timestamp, out_port->fixed_latency_us, out_port->shaper, now, wait_us);
+            if (release != out_queue_rules::Release::send)
             {
-                if (in_port->devaddr == dev_addr && in_port->cable == cable_num)
+                if (release == out_queue_rules::Release::throttle)
                 {
-                    for (auto &out_port : in_port->sends_data_to_list)
-                    {
-                        if (out_port->devaddr != 0 && attached_devices[out_port->devaddr].configured)
-                        {
-                            if (out_port->devaddr != uart_devaddr)
-                                tuh_midi_stream_write(out_port->devaddr, out_port->cable, buffer, bytes_read);
-                            else
-                            {
-                                uint8_t npushed = midi_uart_write_tx_buffer(midi_uart_instance, buffer, bytes_read);
-                                if (npushed != bytes_read)
-                                {
-                                    TU_LOG1("Warning: Dropped %lu bytes sending to UART MIDI Out\r\n", bytes_read - npushed);
-                                }
-                            }
-                        }
-                        else
-                        {
-                            TU_LOG1("skipping %s dev_addr=%u\r\n", out_port->nickname.c_str(), out_port->devaddr);
-                        }
-                    }
-                    break; // found the right in_port; don't need to stay in the loop
+                    ++queue.throttled;
+                    queue.behind = true;
                 }
+                if (wait_us < throttle_us)
+                    throttle_us = wait_us;
+                break;
+            }
+            if (!transmit_packet(out_port, *tx))
+            {
+                queue.behind = true;
+                break;
             }
+            out_pool.pop_front(queue.packets);
+            sent = true;
+        }
+        if (queue.packets.empty() && !queue.needs_eox)
+            out_queue_pending.reset(idx);
+    });
+    // Every cable of a device gets its packets in the same batch so that
+    // they can share a USB transfer
+    publish_usb_tx();
+    if (throttle_us != UINT32_MAX)
+    {
+        out_queue_throttled = true;
+        out_queue_throttled_until = make_timeout_time_us(throttle_us);
+    }
+    if (sent)
+    {
+        // sources blocked by a full queue may be able to send again
+        usb_rx_blocked = false;
+        uart_rx_active = true;
+    }
+}
+
+bool rppicomidi::Midi2usbhub::set_out_queue(Midi_out_port* out_port, uint16_t depth, Overflow_policy policy, bool thin)
+{
+    if (depth < 1 || depth > out_pool.get_capacity())
+        return false;
+    Routing_lock lock(&routing_lock);
+    out_port->queue.depth = depth;
+    out_port->queue.policy = policy;
+    out_port->queue.thin = thin;
+    return true;
+}
+
+bool rppicomidi::Midi2usbhub::set_fixed_latency(Midi_out_port* out_port, uint32_t fixed_latency_us)
+{
+    if (fixed_latency_us > MIDI2USBHUB_MAX_FIXED_LATENCY_US)
+        return false;
+    Routing_lock lock(&routing_lock);
+    out_port->fixed_latency_us = fixed_latency_us;
+    out_port->release_error.reset();
+    return true;
+}
+
+void rppicomidi::Midi2usbhub::reset_release_error_stats()
+{
+    for (auto out_port : midi_out_port_list)
+    {
+        out_port->release_error.reset();
+    }
+}
+
+void rppicomidi::Midi2usbhub::reset_out_queue_stats()
+{
+    Routing_lock lock(&routing_lock);
+    for (auto out_port : midi_out_port_list)
+    {
+        out_port->queue.high_water = out_port->queue.packets.count;
+        out_port->queue.blocked = 0;
+        out_port->queue.throttled = 0;
+        out_port->queue.thinned = 0;
+    }
+    out_pool.reset_high_water();
+}
+
+bool rppicomidi::Midi2usbhub::merge_packet(Midi_in_port* from, Midi_out_port* out_port, const Midi_event& tx, uint32_t held_time)
+{
+    const uint8_t* packet = tx.packet;
+    bool sender_owns_sysex = out_port->sysex_owner != nullptr && out_port->sysex_owner == from;
+    bool other_owns_sysex = out_port->sysex_owner != nullptr && out_port->sysex_owner != from;
+    auto merge = merge_rules::get_merge(packet, sender_owns_sysex, other_owns_sysex);
+    if (merge == merge_rules::Merge::hold)
+    {
+        // another MIDI IN port is in the middle of a SysEx message
+        if (!held_pool.push_back(out_port->held, Held_packet{tx, from, held_time}))
+        {
+            ++out_port->merge_stats.hold_drops;
+            count_drop(out_port, packet);
         }
+        return false;
+    }
+    if (merge == merge_rules::Merge::orphan)
+    {
+        // the rest of a SysEx message the hub already ended because it timed out
+        ++out_port->merge_stats.sysex_orphans;
+        count_drop(out_port, packet);
+        return false;
+    }
+    send_packet(out_port, tx);
+    if (midi_packet::is_realtime(packet))
+        return true; // Real-Time messages never start or end a SysEx message
+    bool sysex_end = midi_packet::get_cin(packet) != 0x4; // CIN 0x5-0x7 end a SysEx message; other CINs are never part of one
+    if (merge_rules::is_sysex_start(packet) && !sysex_end)
+    {
+        out_port->sysex_owner = from;
+        out_port->sysex_last_time = tx.timestamp;
+        sysex_locked_ports.set(out_port->index);
+    }
+    else if (out_port->sysex_owner == from)
+    {
+        if (sysex_end)
+        {
+            out_port->sysex_owner = nullptr;
+            sysex_locked_ports.reset(out_port->index);
+            if (!releasing_held_packets)
+                release_held_packets(out_port);
+        }
+        else
+        {
+            out_port->sysex_last_time = tx.timestamp;
+        }
+    }
+    return true;
+}
+
+void rppicomidi::Midi2usbhub::release_held_packets(Midi_out_port* out_port)
+{
+    // Each held message goes through the merge stage again. Messages from
+    // MIDI IN ports other than a new sysex_owner go back on the list. If
+    // the new sysex_owner's message ends, go through the list again.
+    releasing_held_packets = true;
+    uint32_t now = time_us_32();
+    while (out_port->sysex_owner == nullptr && !out_port->held.empty())
+    {
+        Packet_list pending = out_port->held;
+        out_port->held = Packet_list{};
+        while (!pending.empty())
+        {
+            // return the entry to the pool first so merge_packet() can reuse it
+            Held_packet held = *held_pool.front(pending);
+            held_pool.pop_front(pending);
+            if (merge_packet(held.from, out_port, held.tx, held.held_time))
+                out_port->merge_stats.wait.add(now - held.held_time);
+        }
+    }
+    releasing_held_packets = false;
+}
+void rppicomidi::Midi2usbhub::service_sysex_timeouts()
+{
+    if (!sysex_locked_ports.any())
+        return;
+    Routing_lock lock(&routing_lock);
+    uint32_t now = time_us_32();
+    sysex_locked_ports.for_each([&](size_t idx) {
+        auto out_port = out_port_by_index[idx];
+        if (!merge_rules::is_sysex_timed_out(out_port->sysex_last_time, sysex_timeout_ms, now))
+            return;
+        // End the SysEx message so the receiver is not left waiting for the rest
+        Midi_event tx;
+        tx.packet[0] = 0x5; // SysEx ends with the following single byte
+        midi_packet::set_cable(tx.packet, out_port->cable);
+        tx.packet[1] = 0xF7;
+        tx.packet[2] = 0;
+        tx.packet[3] = 0;
+        tx.from_devaddr = 0;
+        tx.from_cable = 0;
+        tx.timestamp = now;
+        tx.latency_slot = 0;
+        tx.to_index = idx;
+        send_packet(out_port, tx);
+        ++out_port->merge_stats.sysex_timeouts;
+        out_port->sysex_owner = nullptr;
+        sysex_locked_ports.reset(idx);
+        release_held_packets(out_port);
+    });
+}
+
+void rppicomidi::Midi2usbhub::purge_merge_state(const Midi_in_port* from, Midi_out_port* to)
+{
+    for (auto out_port : midi_out_port_list)
+    {
+        if (out_port == to)
+        {
+            out_port->sysex_owner = nullptr;
+            sysex_locked_ports.reset(out_port->index);
+        }
+        else if (out_port->sysex_owner != nullptr && out_port->sysex_owner == from)
+        {
+            // The SysEx message will never finish. Only the routing core may
+            // send to the port, so let the next timeout check end it.
+            out_port->sysex_owner = &removed_sysex_owner;
+            out_port->sysex_last_time = time_us_32() - sysex_timeout_ms * 1000;
+        }
+        held_pool.remove_if(out_port->held, [&](const Held_packet& held) { return held.from == from || out_port == to; });
+        if (out_port == to)
+        {
+            out_pool.clear(out_port->queue.packets);
+            out_queue_pending.reset(out_port->index);
+        }
+    }
+}
+
+void rppicomidi::Midi2usbhub::reset_merge_stats()
+{
+    for (auto out_port : midi_out_port_list)
+    {
+        out_port->merge_stats.reset();
     }
+    held_pool.reset_high_water();
 }
 
 void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets)
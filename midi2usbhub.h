@@ -31,6 +31,7 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include "pico/critical_section.h"
 #include "tusb.h"
 #include "usb_midi_host.h"
 #include "host/usbh_pvt.h"
@@ -38,6 +39,21 @@
 #include "parson.h"
 #include "preset_manager.h"
 #include "midi2usbhub_cli.h"
+#include "port_mask.h"
+#include "running_status_encoder.h"
+#include "midi2usbhub_config.h"
+#include "spsc_queue.h"
+#include "latency_histogram.h"
+#include "midi_stream_parser.h"
+#include "packet_pool.h"
+#include "token_bucket.h"
+#include "merge_rules.h"
+#include "out_queue_rules.h"
+#include "timer_wheel.h"
+#include "route_filter.h"
+#include "route_transform.h"
+#include "held_notes.h"
+#include "keyboard_zones.h"
 namespace rppicomidi
 {
     class Midi2usbhub
@@ -61,6 +77,44 @@ namespace rppicomidi
         void blink_led();
         void flush_usb_tx();
         void poll_midi_uart_rx();
+
+        /**
+         * @brief return true if thru mode is on and the serial port MIDI IN
+         * is connected to the serial port MIDI OUT with no filter, no transform
+         * and no keyboard zones
+         */
+        bool is_uart_thru_active()
+        {
+            return uart_thru && uart_midi_in_port.sends_data_to.test(uart_midi_out_port.index) &&
+                uart_midi_in_port.filter[uart_midi_out_port.index].passes_all() &&
+                uart_midi_in_port.transform_slot[uart_midi_out_port.index] == 0 &&
+                uart_midi_in_port.zones_slot == 0;
+        }
+
+        /**
+         * @brief return true if a FROM port other than the serial port MIDI IN
+         * is connected to the serial port MIDI OUT
+         */
+        bool has_other_uart_out_sources();
+
+        /**
+         * @brief copy bytes from the serial port MIDI IN straight to the
+         * midi_uart_lib transmit buffer and start sending them
+         */
+        void write_uart_thru(uint8_t* bytes, uint8_t nbytes, uint32_t timestamp);
+
+        /**
+         * @brief route the USB MIDI packets the USB host core queued and
+         * publish them to the USB MIDI OUT queues once at the end of the pass.
+         * Runs on the routing core.
+         */
+        void route_usb_rx();
+
+        /**
+         * @brief start the routing core. Call once from main() when
+         * MIDI2USBHUB_DUAL_CORE is 1.
+         */
+        void launch_routing_core();
         /**
          * @brief construct a nickname string from the input parameters
          * 
@@ -82,11 +136,131 @@ namespace rppicomidi
             bool configured;
         };
 
+        static const uint8_t max_cables = 16;
+        // every cable of every USB device plus the UART MIDI OUT port
+        static const size_t max_out_ports = CFG_TUH_DEVICE_MAX * max_cables + 1;
+        typedef Port_mask<max_out_ports> Route_mask;
+        typedef Keyboard_zones<max_out_ports> Input_zones;
+
+        /**
+         * @brief statistics of the time from when the hub receives a MIDI message
+         * until it puts the message in a MIDI OUT port transmit buffer
+         */
+        struct Latency_stats
+        {
+            uint32_t count;
+            uint32_t max_us;
+            uint64_t total_us;
+            void add(uint32_t latency_us) { ++count; total_us += latency_us; if (latency_us > max_us) max_us = latency_us; }
+            void reset() { count = 0; max_us = 0; total_us = 0; }
+            uint32_t get_average_us() const { return count ? static_cast<uint32_t>(total_us / count) : 0; }
+        };
+
+        /**
+         * @brief MIDI traffic counters for one port
+         *
+         * Only one core counts messages and bytes for a given port, and each
+         * core has its own drop counter, so the counters need no locks.
+         */
+        struct Port_stats
+        {
+            uint32_t messages;
+            uint32_t bytes;
+            uint32_t usb_host_core_drops;  // messages dropped by the USB host core
+            uint32_t routing_core_drops;   // messages dropped by the routing core
+            uint32_t peak_per_second;      // most messages in a one second window
+            uint32_t peak_bytes_per_second;// most bytes in a one second window
+            uint32_t window_messages;
+            uint32_t window_bytes;
+            uint32_t window_start;         // time_us_32() time the current window started
+            void add(uint32_t nmessages, uint32_t nbytes, uint32_t now)
+            {
+                messages += nmessages;
+                bytes += nbytes;
+                if (now - window_start >= 1000000)
+                {
+                    window_start = now;
+                    window_messages = 0;
+                    window_bytes = 0;
+                }
+                window_messages += nmessages;
+                window_bytes += nbytes;
+                if (window_messages > peak_per_second)
+                    peak_per_second = window_messages;
+                if (window_bytes > peak_bytes_per_second)
+                    peak_bytes_per_second = window_bytes;
+            }
+            uint32_t get_drops() const { return usb_host_core_drops + routing_core_drops; }
+            void reset()
+            {
+                messages = 0; bytes = 0; usb_host_core_drops = 0; routing_core_drops = 0;
+                peak_per_second = 0; peak_bytes_per_second = 0; window_messages = 0; window_bytes = 0;
+                window_start = time_us_32();
+            }
+        };
+
+        struct Midi_in_port;
+
+        /**
+         * @brief statistics of the merge stage of a MIDI OUT port
+         */
+        struct Merge_stats
+        {
+            Latency_stats wait;     // time messages waited for another MIDI IN port's SysEx message
+            uint32_t sysex_timeouts;// SysEx messages the hub ended because the sender stopped sending
+            uint32_t hold_drops;    // messages dropped because the hold pool was full
+            uint32_t sysex_orphans; // SysEx packets dropped because they came after the hub ended their message
+            void reset() { wait.reset(); sysex_timeouts = 0; hold_drops = 0; sysex_orphans = 0; }
+        };
+
+        // What a MIDI OUT port queue does with a new message when it is full
+        enum class Overflow_policy : uint8_t
+        {
+            drop_newest,    // drop the new message
+            drop_oldest,    // drop the oldest queued message that is not part of a SysEx message
+            block_source,   // leave the new message with its MIDI IN port until there is room
+        };
+
+        /**
+         * @brief the queue of a MIDI OUT port. The routing core uses it with
+         * the routing lock held.
+         */
+        struct Out_queue
+        {
+            Packet_list packets;
+            uint16_t depth = MIDI2USBHUB_OUT_QUEUE_DEPTH; // most packets the queue may hold
+            Overflow_policy policy = Overflow_policy::drop_newest;
+            uint16_t high_water = 0;
+            uint32_t blocked = 0;        // times a MIDI IN port had to wait for room
+            uint32_t throttled = 0;      // times the rate limit kept the queue from sending
+            uint32_t thinned = 0;        // stale controller values removed while the queue was behind
+            bool thin = true;            // remove stale controller values while the queue is behind
+            bool behind = false;         // the last pass left packets that were due to go out
+            bool sysex_open = false;     // queued a SysEx message's start but not its end
+            bool dropping_sysex = false; // dropping the rest of a SysEx message that did not fit
+            bool needs_eox = false;      // must queue End of SysEx for a SysEx message cut short
+        };
+
         struct Midi_out_port
         {
             uint8_t devaddr;
             uint8_t cable;
+            uint8_t index; // this port's bit in a Route_mask
             std::string nickname;
+            Port_stats stats{}; // messages sent and dropped
+            // Merge stage state. The routing core uses it with the routing lock held.
+            Midi_in_port* sysex_owner = nullptr; // the MIDI IN port sending a SysEx message here
+            uint32_t sysex_last_time = 0;        // time_us_32() time sysex_owner last sent part of it
+            Packet_list held;                    // messages waiting for sysex_owner to finish
+            Merge_stats merge_stats{};
+            Out_queue queue{};
+            Token_bucket shaper;                 // limits the port to its wire rate
+            uint32_t fixed_latency_us = 0;       // 0, or send each message this long after the hub received it
+            Latency_stats release_error{};       // how far from its release time each message left in fixed latency mode
+            void add_release_error(uint32_t latency_us)
+            {
+                release_error.add(latency_us > fixed_latency_us ? latency_us - fixed_latency_us : fixed_latency_us - latency_us);
+            }
         };
 
         struct Midi_in_port
@@ -94,7 +268,90 @@ namespace rppicomidi
             uint8_t devaddr;
             uint8_t cable;
             std::string nickname;
-            std::vector<Midi_out_port *> sends_data_to_list;
+            Route_mask sends_data_to; // bit n set means send to get_midi_out_port(n)
+            // latency_slot[n] is 1 + the index into the route latency table for the route
+            // to get_midi_out_port(n), or 0 if the route has no latency histogram yet
+            uint8_t latency_slot[max_out_ports] = {};
+            uint16_t delay_ms[max_out_ports] = {}; // delay_ms[n] is the delay of the route to get_midi_out_port(n)
+            Route_filter filter[max_out_ports];    // filter[n] decides what the route to get_midi_out_port(n) sends
+            // transform_slot[n] is 1 + the index into the route transform table for the route
+            // to get_midi_out_port(n), or 0 if the route has no transform
+            uint8_t transform_slot[max_out_ports] = {};
+            // 1 + the index into the keyboard zone table, or 0 if the port has no zones
+            uint8_t zones_slot = 0;
+            Port_stats stats{}; // messages received; drops are messages lost before routing
+        };
+
+        // The latency histogram of MIDI messages on one route from a MIDI IN port to a MIDI OUT port
+        struct Route_latency
+        {
+            bool in_use;
+            uint8_t from_devaddr;
+            uint8_t from_cable;
+            uint8_t to_index;
+            Latency_histogram histogram;
+        };
+        struct Pipeline_stats
+        {
+            Latency_stats usb_out_latency;  // updated by the USB host core
+            Latency_stats uart_out_latency; // updated by the routing core
+            uint32_t usb_rx_queue_full;     // times the USB host core had to wait for the routing core
+            uint32_t usb_tx_dropped;        // packets dropped because a USB OUT queue was full
+            void reset() { usb_out_latency.reset(); uart_out_latency.reset(); usb_rx_queue_full = 0; usb_tx_dropped = 0; }
+        };
+
+        /**
+         * @brief when the USB host core starts a bulk OUT transfer
+         */
+        enum class Usb_flush_mode : uint8_t
+        {
+            latency,    // as soon as there is anything to send
+            throughput, // when a transfer is full, on a real-time message or at the flush deadline
+        };
+
+        struct Usb_flush_stats
+        {
+            uint32_t transfers;        // bulk OUT transfers started
+            uint32_t bytes;            // bytes in those transfers
+            uint32_t full_flushes;     // transfers started because a transfer's worth of bytes was waiting
+            uint32_t deadline_flushes; // transfers started because the flush deadline expired
+            uint64_t since_us;         // time_us_64() when the statistics were reset
+            void reset() { transfers = 0; bytes = 0; full_flushes = 0; deadline_flushes = 0; since_us = time_us_64(); }
+        };
+
+        /**
+         * @brief statistics for one MIDI source: a USB MIDI device or the
+         * serial port MIDI IN
+         */
+        struct Input_stats
+        {
+            uint32_t passes;   // passes that read anything from the source
+            uint32_t deferred; // passes that used the whole input budget and left the rest for later
+            Latency_stats wait; // time from reading a USB MIDI packet until routing it
+            void reset() { passes = 0; deferred = 0; wait.reset(); }
+        };
+
+        /**
+         * @brief how the hub writes to a USB MIDI device with a particular
+         * VID and PID
+         */
+        struct Device_profile
+        {
+            uint16_t vid;
+            uint16_t pid;
+            uint32_t max_packets_per_second; // 0 means no limit
+            uint32_t sysex_gap_us;           // minimum time between SysEx bulk transfers; 0 means none
+            bool use_flush_mode;             // false means use the flush command's mode
+            Usb_flush_mode flush_mode;
+        };
+
+        struct Idle_stats
+        {
+            uint64_t idle_us;      // time spent sleeping
+            uint64_t since_us;     // time_us_64() when the statistics were reset
+            uint32_t sleeps;
+            Latency_stats wake_latency; // time from an event flag being set until the core runs
+            void reset() { idle_us = 0; since_us = time_us_64(); sleeps = 0; wake_latency.reset(); }
         };
         void *midi_uart_instance;
         void tuh_mount_cb(uint8_t dev_addr);
@@ -131,11 +388,21 @@ namespace rppicomidi
          * of the MIDI stream source
          * @param to_nickname the nickname that represents the device an port
          * of the MIDI stream sink
-         * @return int 0 if successful, -1 if the to_nickname is invalid, -2
-         * if the from_nickname is invalid
+         * @return int 0 if successful, 1 if successful but the observed peak
+         * rates of the FROM ports now routed to the TO port add up to more
+         * than the TO port can send, -1 if the to_nickname is invalid, -2
+         * if the from_nickname is invalid, -3 if to_nickname is the serial
+         * port MIDI OUT in thru mode and from_nickname is not the serial
+         * port MIDI IN
          */
         int connect(const std::string& from_nickname, const std::string& to_nickname);
 
+        /**
+         * @brief get the sum of the peak bytes per second of every MIDI IN
+         * port routed to out_port
+         */
+        uint32_t get_routed_peak_bytes_per_second(const Midi_out_port* out_port);
+
         /**
          * @brief disconnect the MIDI stream from the device and port from_nickname
          * to the device and port to_nickname
@@ -149,6 +416,83 @@ namespace rppicomidi
          */
         int disconnect(const std::string& from_nickname, const std::string& to_nickname);
 
+        /**
+         * @brief delay the MIDI stream from from_nickname to to_nickname by
+         * delay_ms milliseconds. Disconnecting the route sets its delay to 0.
+         *
+         * @return int 0 if successful, -1 if the to_nickname is invalid or
+         * the FROM port is not connected to it, -2 if the from_nickname is
+         * invalid, -3 if delay_ms is more than MIDI2USBHUB_MAX_ROUTE_DELAY_MS
+         */
+        int set_route_delay(const std::string& from_nickname, const std::string& to_nickname, uint16_t delay_ms);
+
+        /**
+         * @brief set which messages the route from from_nickname to to_nickname
+         * sends. Disconnecting the route makes it send everything again.
+         *
+         * @return int 0 if successful, -1 if the to_nickname is invalid or
+         * the FROM port is not connected to it, -2 if the from_nickname is invalid
+         */
+        int set_route_filter(const std::string& from_nickname, const std::string& to_nickname, const Route_filter& filter);
+
+        /**
+         * @brief set the chain of transforms the route from from_nickname to
+         * to_nickname applies to its messages. An empty transform removes the
+         * route's transform. Disconnecting the route removes it too. Notes
+         * the route holds when its transform changes or goes away get a Note
+         * Off through the old transform.
+         *
+         * @return int 0 if successful, -1 if the to_nickname is invalid or
+         * the FROM port is not connected to it, -2 if the from_nickname is
+         * invalid, -3 if MIDI2USBHUB_MAX_ROUTE_TRANSFORMS routes already have one
+         */
+        int set_route_transform(const std::string& from_nickname, const std::string& to_nickname, const Route_transform& transform);
+
+        /**
+         * @brief get the transform of the route from in_port to get_midi_out_port(to_index)
+         *
+         * @return nullptr if the route has no transform
+         */
+        const Route_transform* get_route_transform(const Midi_in_port* in_port, size_t to_index) const
+        {
+            uint8_t slot = in_port->transform_slot[to_index];
+            return slot != 0 ? &route_transforms[slot - 1] : nullptr;
+        }
+
+        /**
+         * @brief send the notes lowest through highest from from_nickname only to
+         * the TO ports in to_nicknames. TO ports the FROM port is connected to
+         * that are in no zone still get every note. Disconnecting a TO port
+         * takes it out of the FROM port's zones.
+         *
+         * @param zone the zone number 0 to Input_zones::max_zones-1
+         * @return int 0 if successful, -1 if a TO nickname is invalid or the
+         * FROM port is not connected to it, -2 if the from_nickname is invalid,
+         * -3 if the zone number or the note range is invalid or the note range
+         * overlaps another zone, -4 if MIDI2USBHUB_MAX_ZONED_INPUTS FROM ports
+         * already have zones
+         */
+        int set_zone(const std::string& from_nickname, uint8_t zone, uint8_t lowest, uint8_t highest,
+                     const std::vector<std::string>& to_nicknames);
+
+        /**
+         * @brief remove keyboard zone number zone from from_nickname, or all of
+         * its zones if zone is Input_zones::max_zones
+         *
+         * @return int 0 if successful, -2 if the from_nickname is invalid
+         */
+        int remove_zone(const std::string& from_nickname, uint8_t zone);
+
+        /**
+         * @brief get the keyboard zones of in_port
+         *
+         * @return nullptr if in_port has no zones
+         */
+        const Input_zones* get_zones(const Midi_in_port* in_port) const
+        {
+            return in_port->zones_slot != 0 ? &keyboard_zones[in_port->zones_slot - 1] : nullptr;
+        }
+
         /**
          * @brief clear all MIDI stream connections
          *
@@ -166,22 +510,283 @@ namespace rppicomidi
         int rename(const std::string& old_nickname, const std::string& new_nickname);
 
         /**
-         * @brief route the MIDI traffic
+         * @brief run the USB host stack, the CLI and, in single core builds,
+         * the MIDI routing
          *
          */
         void task();
 
+        /**
+         * @brief route the MIDI traffic and service the serial port MIDI.
+         * Called from the routing core main loop or, in single core
+         * builds, from task()
+         */
+        void routing_task();
+
+        /**
+         * @brief if MIDI2USBHUB_IDLE_WFE is 1 and the USB host core has no
+         * pending work, sleep until an interrupt, the routing core or the
+         * next timer deadline wakes it. Otherwise return right away.
+         */
+        void idle_usb_host_core();
+
+        /**
+         * @brief if MIDI2USBHUB_IDLE_WFE is 1 and the routing core has no
+         * pending work, sleep until an interrupt, the USB host core or the
+         * next timer deadline wakes it. Otherwise return right away.
+         */
+        void idle_routing_core();
+
         Midi_device_info* get_attached_device(size_t addr) { if (addr < 1 || addr > uart_devaddr) return nullptr; return &attached_devices[addr]; }
         const std::vector<Midi_out_port *>& get_midi_out_port_list() {return midi_out_port_list; }
         const std::vector<Midi_in_port *>& get_midi_in_port_list() {return midi_in_port_list; }
+        Running_status_encoder& get_uart_tx_encoder() { return uart_tx_encoder; }
+
+        /**
+         * @brief turn the serial port MIDI thru mode on or off. In thru mode,
+         * while the serial port MIDI IN is connected to the serial port MIDI
+         * OUT with no filter, the routing core copies each byte from the serial port MIDI IN
+         * to the serial port MIDI OUT as soon as it reads it, and no other
+         * FROM port may connect to the serial port MIDI OUT.
+         *
+         * @return true if successful, false if another FROM port is connected
+         * to the serial port MIDI OUT
+         */
+        bool set_uart_thru(bool enabled);
+        bool get_uart_thru() const { return uart_thru; }
+        Pipeline_stats& get_pipeline_stats() { return pipeline_stats; }
+        Usb_flush_stats& get_usb_flush_stats() { return usb_flush_stats; }
+        Usb_flush_mode get_usb_flush_mode() const { return usb_flush_mode; }
+        const std::vector<Device_profile>& get_device_profiles() const { return device_profiles; }
+
+        /**
+         * @brief add a device profile or replace the one with the same VID and
+         * PID, and apply it to attached devices with that VID and PID
+         */
+        void set_device_profile(const Device_profile& profile);
+
+        /**
+         * @brief delete the device profile with the given VID and PID
+         *
+         * @return true if successful, false if there is no such profile
+         */
+        bool delete_device_profile(uint16_t vid, uint16_t pid);
+
+        /**
+         * @brief create a JSON formatted string of the device profiles
+         *
+         * The JSON format is
+         * {
+         *     "vvvv-pppp": {"max_packets_per_second": n, "sysex_gap_us": n, "flush": "latency"|"throughput"|"default"},
+         *     ...
+         * }
+         * where vvvv and pppp are the VID and PID in lowercase hexadecimal
+         */
+        void serialize_device_profiles(std::string& serialized_profiles);
+
+        /**
+         * @brief replace the device profiles with those in a JSON string
+         * serialize_device_profiles() made
+         *
+         * @return true if successful, false if the string is not valid
+         */
+        bool deserialize_device_profiles(std::string& serialized_profiles);
+
+        /**
+         * @brief save the device profiles to the flash file system
+         *
+         * @return true if successful, false otherwise
+         */
+        bool save_device_profiles();
+
+        /**
+         * @brief replace the device profiles with the ones saved in the flash
+         * file system
+         *
+         * @return true if successful, false if there are no saved profiles or
+         * they could not be read
+         */
+        bool load_device_profiles();
+        void set_usb_flush_mode(Usb_flush_mode mode) { usb_flush_mode = mode; }
+        uint32_t get_usb_flush_deadline_us() const { return usb_flush_deadline_us; }
+        void set_usb_flush_deadline_us(uint32_t deadline_us) { usb_flush_deadline_us = deadline_us; }
+        Idle_stats& get_idle_stats(uint core) { return idle_stats[core ? 1 : 0]; }
+        size_t get_usb_rx_queue_high_water() const { return usb_rx_queue.get_high_water(); }
+        uint16_t get_input_budget() const { return input_budget; }
+        void set_input_budget(uint16_t budget) { input_budget = budget; }
+        Input_stats* get_input_stats(uint8_t devaddr) { return devaddr < 1 || devaddr > uart_devaddr ? nullptr : &input_stats[devaddr]; }
+        void reset_input_stats() { for (auto& stats : input_stats) stats.reset(); }
+        Midi_out_port* get_midi_out_port(size_t index) { return index < max_out_ports ? out_port_by_index[index] : nullptr; }
+        Midi_in_port* get_midi_in_port(uint8_t devaddr, uint8_t cable) { return (devaddr <= uart_devaddr && cable < max_cables) ? in_port_lookup[devaddr][cable] : nullptr; }
+        const Route_latency* get_route_latency(size_t idx) const { return idx < MIDI2USBHUB_MAX_LATENCY_ROUTES ? &route_latency[idx] : nullptr; }
+        uint32_t get_untracked_route_messages() const { return untracked_route_messages; }
+        uint32_t get_sysex_timeout_ms() const { return sysex_timeout_ms; }
+        void set_sysex_timeout_ms(uint32_t timeout_ms) { sysex_timeout_ms = timeout_ms; }
+        uint16_t get_merge_hold_high_water() const { return held_pool.get_high_water(); }
+        uint16_t get_out_queue_pool_high_water() const { return out_pool.get_high_water(); }
+        uint16_t get_delay_pool_high_water() const { return delay_wheel.get_high_water(); }
+        uint16_t get_num_delayed_packets() const { return delay_wheel.get_num_waiting(); }
+
+        /**
+         * @brief set the maximum number of packets in a MIDI OUT port's queue,
+         * what the queue does when it is full, and whether it removes stale
+         * controller values while it is behind
+         *
+         * @return true if successful, false if depth is out of range
+         */
+        bool set_out_queue(Midi_out_port* out_port, uint16_t depth, Overflow_policy policy, bool thin);
+
+        /**
+         * @brief clear the high water mark and counters of all MIDI OUT port queues
+         */
+        void reset_out_queue_stats();
+
+        /**
+         * @brief make out_port send each message exactly fixed_latency_us
+         * microseconds after the hub received it instead of as soon as it can.
+         * Messages then arrive with the same spacing they had at the hub's input.
+         *
+         * @param fixed_latency_us 0 to send messages as soon as possible
+         * @return true if successful, false if fixed_latency_us is more than
+         * MIDI2USBHUB_MAX_FIXED_LATENCY_US
+         */
+        bool set_fixed_latency(Midi_out_port* out_port, uint32_t fixed_latency_us);
+
+        /**
+         * @brief clear the fixed latency release error statistics of all MIDI OUT ports
+         */
+        void reset_release_error_stats();
+
+        /**
+         * @brief clear the merge statistics of all MIDI OUT ports
+         */
+        void reset_merge_stats();
+
+        /**
+         * @brief clear all route latency histograms
+         */
+        void reset_route_latency();
+
+        /**
+         * @brief clear the traffic counters of all MIDI IN and MIDI OUT ports
+         */
+        void reset_port_stats();
+
+        /**
+         * @brief count the MIDI messages that start in a MIDI byte stream
+         *
+         * Every status byte except End of SysEx starts a message. Messages
+         * sent with running status are not counted.
+         */
+        static uint32_t count_messages(const uint8_t* bytes, uint8_t nbytes)
+        {
+            uint32_t nmessages = 0;
+            for (uint8_t idx = 0; idx < nbytes; idx++)
+            {
+                if ((bytes[idx] & 0x80) != 0 && bytes[idx] != 0xF7)
+                    ++nmessages;
+            }
+            return nmessages;
+        }
     private:
         Midi2usbhub();
         Preset_manager preset_manager;
 
         static void langid_cb(tuh_xfer_t *xfer);
         static void prod_str_cb(tuh_xfer_t *xfer);
+        static void routing_core_main();
+        static void console_chars_available_cb(void*);
+        bool usb_host_core_has_work();
+
+        /**
+         * @brief get how long until the USB host core must start the next
+         * bulk OUT transfer
+         *
+         * @return uint32_t microseconds until the earliest flush deadline,
+         * 0 if a transfer is due now, or UINT32_MAX if no device has
+         * packets waiting
+         */
+        uint32_t get_usb_flush_wait_us();
+        bool routing_core_has_work();
+
+        /**
+         * @brief sleep until an event or deadline wakes this core
+         *
+         * @param stats the statistics for this core
+         * @param deadline the time to wake up if no event happens first
+         * @return uint32_t the time_us_32() time the core woke up
+         */
+        uint32_t wait_for_event(Idle_stats& stats, absolute_time_t deadline);
+
+        /**
+         * @brief get the time the routing core must wake up if nothing else wakes it
+         */
+        absolute_time_t get_routing_core_deadline();
 
+        /**
+         * @brief tell the USB host core it has work to do
+         */
+        void ring_usb_host_doorbell();
+        void configure_midi_uart();
 
+        /**
+         * @brief set up the device's pacing from the profile that matches its
+         * VID and PID, or no pacing if there is none
+         */
+        void apply_device_profile(uint8_t dev_addr);
+
+        /**
+         * @brief copy at most input_budget USB MIDI packets from the USB host
+         * driver's receive buffer to the usb_rx_queue
+         *
+         * @param dev_addr the device address of the USB MIDI device
+         */
+        void read_usb_rx(uint8_t dev_addr);
+
+        /**
+         * @brief Hold the routing lock for the lifetime of this object
+         *
+         * The USB host core holds the lock while it changes the routing
+         * tables or the port lists. The routing core holds it while it
+         * sends a message to the destinations in a route set.
+         */
+        class Routing_lock
+        {
+        public:
+            Routing_lock(critical_section_t* cs_) : cs{cs_} { critical_section_enter_blocking(cs); }
+            ~Routing_lock() { critical_section_exit(cs); }
+            Routing_lock(Routing_lock const&) = delete;
+            void operator=(Routing_lock const&) = delete;
+        private:
+            critical_section_t* cs;
+        };
+
+        /**
+         * @brief the record every stage of the routing pipeline passes along:
+         * one USB MIDI event packet, the MIDI IN port it came from and the
+         * time_us_32() time the hub received it. Ingress fills in the source
+         * and the timestamp; routing fills in the destination and sets the
+         * cable number in the packet to the destination's cable. A route
+         * delay line adds the route's delay to the timestamp.
+         */
+        struct Midi_event
+        {
+            uint8_t packet[4];
+            uint8_t from_devaddr;   // the MIDI IN port's device address; uart_devaddr for the serial port, 0 for messages the hub makes
+            uint8_t from_cable;     // the MIDI IN port's virtual cable number
+            uint8_t to_index;       // the Midi_out_port::index of the destination
+            uint8_t latency_slot;   // the route's Midi_in_port::latency_slot entry
+            uint32_t timestamp;
+        };
+        static_assert(sizeof(Midi_event) == 12, "Midi_event must stay small enough to copy between the cores");
+
+        // A message waiting in the merge stage of a MIDI OUT port
+        struct Held_packet
+        {
+            Midi_event tx;
+            Midi_in_port* from;
+            uint32_t held_time; // time_us_32() time the merge stage held the message
+        };
 
         // UART selection Pin mapping. You can move these for your design if you want to
         // Make sure all these values are consistent with your choice of midi_uart
@@ -194,6 +799,256 @@ namespace rppicomidi
 
         static const uint8_t uart_devaddr = CFG_TUH_DEVICE_MAX + 1;
 
+        /**
+         * @brief rebuild the in_port_lookup table from the midi_in_port_list
+         *
+         * Call this any time the midi_in_port_list changes or a preset load
+         * changes the routing. The caller must hold the routing lock.
+         */
+        void rebuild_in_port_lookup();
+
+        /**
+         * @brief give the out_port the lowest unused index into out_port_by_index
+         *
+         * @return true if successful, false if all indices are in use
+         */
+        bool assign_out_port_index(Midi_out_port* out_port);
+
+        /**
+         * @brief encode MIDI bytes with running status and push them to the
+         * UART MIDI OUT transmit buffer
+         *
+         * @param bytes the MIDI bytes to send
+         * @param nbytes the number of bytes to send
+         * @return true if successful, false if there is no room for all of the bytes
+         */
+        bool write_uart_tx(const uint8_t* bytes, uint8_t nbytes, uint32_t timestamp, uint8_t latency_slot);
+
+        /**
+         * @brief move bytes from uart_tx_queue to the midi_uart_lib transmit buffer
+         * while fewer than MIDI2USBHUB_UART_TX_LOOKAHEAD bytes are waiting to go out
+         */
+        void service_uart_tx();
+
+        /**
+         * @brief get the time service_uart_tx() can next move a byte; only
+         * meaningful if uart_tx_queue is not empty
+         */
+        absolute_time_t get_uart_tx_refill_time();
+
+        /**
+         * @brief hand a packet to the USB host core or to the serial port
+         * MIDI OUT. System Real-Time packets for USB devices go to the device's
+         * realtime queue; everything else goes to the device's usb_tx_queue.
+         * USB packets stay staged until publish_usb_tx(). Runs on the routing core.
+         *
+         * @return true if successful, false if there is no room for the whole packet
+         */
+        bool transmit_packet(Midi_out_port* out_port, const Midi_event& tx);
+
+        /**
+         * @brief let the USB host core see every packet transmit_packet()
+         * staged since the last call, so that packets for several cables of
+         * one device reach the device's OUT buffer together and can share
+         * a bulk transfer
+         */
+        void publish_usb_tx();
+
+        /**
+         * @brief put a packet in out_port's queue, applying the queue's overflow
+         * policy if the queue is full. Never splits a message.
+         */
+        void queue_out_packet(Midi_out_port* out_port, const Midi_event& tx);
+
+        /**
+         * @brief remove the packets in out_port's queue that tx makes stale:
+         * earlier values of the same controller, pitch bend, channel pressure
+         * or polyphonic key pressure on the same channel. 14-bit controllers
+         * are removed only as complete MSB/LSB pairs. Bank Select, RPN, NRPN,
+         * Data Entry, channel mode messages, notes and SysEx are never removed.
+         */
+        void thin_out_queue(Midi_out_port* out_port, const Midi_event& tx);
+
+        /**
+         * @brief count a packet the hub could not send to out_port
+         */
+        void count_drop(Midi_out_port* out_port, const uint8_t packet[4]);
+
+        /**
+         * @brief make room for one packet in out_port's queue if its policy allows
+         *
+         * @return true if the queue has room for one more packet
+         */
+        bool make_out_queue_room(Midi_out_port* out_port);
+
+        /**
+         * @brief get how many packets from in_port the MIDI OUT ports with the
+         * block_source policy that it routes to can take without dropping any
+         */
+        uint16_t get_block_source_room(Midi_in_port* in_port);
+
+        /**
+         * @brief move packets from the MIDI OUT port queues to the USB host core
+         * and the serial port MIDI OUT as fast as they can take them
+         */
+        void service_out_queues();
+
+        /**
+         * @brief put tx in the delay line of the route from in_port to
+         * out_port. Runs on the routing core with the routing lock held.
+         *
+         * tx's timestamp becomes the time it is due, so the latency
+         * statistics and fixed latency mode count from there.
+         */
+        void delay_packet(Midi_out_port* out_port, Midi_event& tx, uint16_t delay_ms);
+
+        /**
+         * @brief send the packets in the route delay lines that are due
+         * to the merge stage of their MIDI OUT ports
+         */
+        void service_delay_lines();
+
+        /**
+         * @brief send a packet from a delay line that is due to the merge stage
+         * of its MIDI OUT port if its route still exists. The caller must hold
+         * the routing lock.
+         */
+        void release_delayed_packet(const Midi_event& tx, uint32_t now);
+
+        // The route delay lines count time in ticks of delay_tick_us
+        static const uint32_t delay_tick_us = 1024;
+        static const uint16_t delay_wheel_slots = 512;
+        static_assert(MIDI2USBHUB_MAX_ROUTE_DELAY_MS * 1000 / delay_tick_us + 1 < delay_wheel_slots,
+            "the route delay timer wheel must span the longest route delay");
+        static uint32_t get_delay_tick() { return static_cast<uint32_t>(time_us_64() / delay_tick_us); }
+
+        /**
+         * @brief route the complete USB MIDI event packet in event from in_port
+         * to all of its destinations. Each destination gets a copy of the same
+         * packet with its own cable number. Runs on the routing core with the
+         * routing lock held. The caller calls publish_usb_tx() when done.
+         */
+        void route_packet(Midi_in_port* in_port, const Midi_event& event);
+
+        /**
+         * @brief set the delay, the filter and the transform of the route from
+         * in_port to get_midi_out_port(to_index) back to their defaults and
+         * take the MIDI OUT port out of in_port's keyboard zones
+         */
+        void clear_route_settings(Midi_in_port* in_port, size_t to_index);
+
+        /**
+         * @brief copy transform to the route transform table entry of the route
+         * from in_port to get_midi_out_port(to_index); assign one if the route
+         * does not have one yet. The caller must hold the routing lock.
+         *
+         * @return false if the table is full
+         */
+        bool store_route_transform(Midi_in_port* in_port, size_t to_index, const Route_transform& transform);
+
+        /**
+         * @brief remove the transform of the route from in_port to
+         * get_midi_out_port(to_index). The caller must hold the routing lock.
+         */
+        void clear_route_transform(Midi_in_port* in_port, size_t to_index);
+
+        /**
+         * @brief turn off the notes the route from in_port to
+         * get_midi_out_port(to_index) holds through the route's transform. The
+         * Note Offs wait in note_off_list for the routing core to send them.
+         * The caller must hold the routing lock.
+         */
+        void release_transform_notes(Midi_in_port* in_port, size_t to_index);
+
+        /**
+         * @brief send the Note Offs release_transform_notes() left in
+         * note_off_list. Runs on the routing core.
+         */
+        void service_transform_note_offs();
+
+        /**
+         * @brief set keyboard zone number zone of in_port; assign in_port a
+         * keyboard zone table entry if it does not have one yet, preferring
+         * the entry it had last. The caller must hold the routing lock.
+         *
+         * @return 0 if successful, -3 if the zone is invalid, -4 if the table is full
+         */
+        int store_zone(Midi_in_port* in_port, uint8_t zone, uint8_t lowest, uint8_t highest, const Route_mask& sends_to);
+
+        /**
+         * @brief free in_port's keyboard zone table entry if it has no zones left.
+         * The caller must hold the routing lock.
+         */
+        void release_empty_zones(Midi_in_port* in_port);
+
+        /**
+         * @brief send a packet to a MIDI OUT port without splitting a SysEx message
+         * another MIDI IN port is sending to the MIDI OUT port
+         *
+         * While one MIDI IN port sends a SysEx message to out_port, hold
+         * the messages other MIDI IN ports send to out_port, except System
+         * Real-Time messages, until the SysEx message ends or times out.
+         * Runs on the routing core with the routing lock held.
+         *
+         * @param held_time the time_us_32() time the merge stage first saw the packet
+         * @return true if the packet was sent; false if it was held or dropped
+         */
+        bool merge_packet(Midi_in_port* from, Midi_out_port* out_port, const Midi_event& tx, uint32_t held_time);
+
+        /**
+         * @brief send a System Real-Time packet straight to the USB host core or
+         * to the serial port MIDI OUT; queue any other packet in out_port's queue.
+         * In fixed latency mode, queue every packet.
+         */
+        void send_packet(Midi_out_port* out_port, const Midi_event& tx);
+
+        /**
+         * @brief send the messages out_port held while its SysEx lock was taken,
+         * in the order they arrived, until another SysEx lock is taken
+         */
+        void release_held_packets(Midi_out_port* out_port);
+
+        /**
+         * @brief end SysEx messages whose senders have stopped sending.
+         * Runs on the routing core.
+         */
+        void service_sysex_timeouts();
+
+        /**
+         * @brief forget the held messages and SysEx locks that involve from or to.
+         * Call with the routing lock held before deleting a port; either may be nullptr.
+         */
+        void purge_merge_state(const Midi_in_port* from, Midi_out_port* to);
+
+        /**
+         * @brief get the latency slot for the route from in_port to the
+         * MIDI OUT port with index to_index; assign one if the route does not
+         * have one yet. Runs on the routing core with the routing lock held.
+         *
+         * @return the Midi_in_port::latency_slot value, 0 if the table is full
+         */
+        uint8_t get_latency_slot(Midi_in_port* in_port, size_t to_index);
+
+        /**
+         * @brief add a sample to the histogram of the route with latency_slot
+         *
+         * @param latency_slot the Midi_in_port::latency_slot value of the route
+         * @param latency_us the time from when the hub received the message until
+         * it sent it
+         */
+        void add_route_latency(uint8_t latency_slot, uint32_t latency_us)
+        {
+            if (latency_slot != 0 && route_latency[latency_slot - 1].in_use)
+                route_latency[latency_slot - 1].histogram.add(latency_us);
+        }
+
+        /**
+         * @brief free the route latency table entries of routes that no longer exist
+         *
+         * Call this any time a route is removed. The caller must hold the routing lock.
+         */
+        void release_stale_route_latency();
+
         // Indexed by dev_addr
         // device addresses start at 1. location 0 is unused
         // extra entry is for the UART MIDI Port
@@ -202,8 +1057,108 @@ namespace rppicomidi
         std::vector<Midi_out_port *> midi_out_port_list;
         std::vector<Midi_in_port *> midi_in_port_list;
 
+        // Indexed by [dev_addr][cable]; nullptr if there is no MIDI IN port.
+        // Lets the MIDI receive path find the route set for a stream without
+        // searching midi_in_port_list.
+        Midi_in_port* in_port_lookup[CFG_TUH_DEVICE_MAX + 2][max_cables];
+
+        // Indexed by Midi_out_port::index; nullptr if the index is free.
+        Midi_out_port* out_port_by_index[max_out_ports];
+
         Midi_in_port uart_midi_in_port;
         Midi_out_port uart_midi_out_port;
+        Running_status_encoder uart_tx_encoder;
+
+        critical_section_t routing_lock;
+        // USB host core to routing core
+        Spsc_queue<Midi_event, MIDI2USBHUB_USB_RX_QUEUE_SIZE> usb_rx_queue;
+        // true if the device's packets did not all fit in usb_rx_queue
+        bool usb_rx_pending[CFG_TUH_DEVICE_MAX + 1];
+        uint8_t next_usb_rx_devaddr; // the device task() reads first; rotates for fairness
+        uint16_t input_budget;       // USB MIDI packets per source per pass
+        Input_stats input_stats[uart_devaddr + 1]; // indexed by dev_addr
+        // routing core to USB host core, indexed by dev_addr
+        Spsc_queue<Midi_event, MIDI2USBHUB_USB_TX_QUEUE_SIZE> usb_tx_queue[CFG_TUH_DEVICE_MAX + 1];
+        // routing core to USB host core System Real-Time packets, indexed by dev_addr;
+        // flush_usb_tx() sends these first
+        Spsc_queue<Midi_event, MIDI2USBHUB_USB_RT_QUEUE_SIZE> usb_rt_queue[CFG_TUH_DEVICE_MAX + 1];
+        // true if the routing core has staged packets in the device's usb_tx_queue or usb_rt_queue
+        bool usb_tx_staged[CFG_TUH_DEVICE_MAX + 1];
+        // serial port MIDI OUT bytes other than System Real-Time bytes; used only by the routing core
+        Spsc_queue<uint8_t, MIDI2USBHUB_UART_TX_QUEUE_SIZE> uart_tx_queue;
+        Midi_stream_parser uart_rx_parser;
+        // The merge stage of every MIDI OUT port shares this
+        Packet_pool<Held_packet, MIDI2USBHUB_MERGE_HOLD_POOL_SIZE> held_pool;
+        // The queues of every MIDI OUT port share this
+        Packet_pool<Midi_event, MIDI2USBHUB_OUT_QUEUE_POOL_SIZE> out_pool;
+        // The delay lines of every route share this
+        Timer_wheel<Midi_event, delay_wheel_slots, MIDI2USBHUB_DELAY_POOL_SIZE> delay_wheel;
+        Route_mask out_queue_pending;   // MIDI OUT ports with something to send
+        Route_mask sysex_locked_ports;  // MIDI OUT ports with a sysex_owner
+        uint32_t sysex_timeout_ms;
+        bool releasing_held_packets;
+        // sysex_owner of MIDI OUT ports whose SysEx sender was unplugged mid-message
+        Midi_in_port removed_sysex_owner;
+        Pipeline_stats pipeline_stats;
+        // USB host core bulk OUT transfer scheduling, indexed by dev_addr
+        struct Usb_flush_state
+        {
+            uint16_t pending_bytes; // bytes written to the device's OUT buffer but not yet transferred
+            uint32_t pending_since; // time_us_32() the oldest of those bytes was written
+            bool urgent;            // the buffer is full or holds a System Real-Time message
+            bool waiting;           // the previous transfer was still in progress at the last try
+            // pacing from the device's profile
+            bool paced;             // packets are waiting for pacer or the SysEx gap
+            uint32_t paced_until;   // time_us_32() time they may go
+            Token_bucket pacer;     // limits the packet rate
+            uint32_t sysex_gap_us;  // minimum time between bulk transfers that carry SysEx
+            uint16_t sysex_chunk_bytes; // SysEx bytes in the OUT buffer
+            uint32_t last_sysex_transfer; // time_us_32() time of the last transfer with SysEx
+            bool use_flush_mode;    // true to use flush_mode instead of usb_flush_mode
+            Usb_flush_mode flush_mode;
+            Usb_flush_mode get_flush_mode(Usb_flush_mode default_mode) const { return use_flush_mode ? flush_mode : default_mode; }
+        };
+        Usb_flush_state usb_flush[CFG_TUH_DEVICE_MAX + 1];
+        std::vector<Device_profile> device_profiles;
+        Usb_flush_mode usb_flush_mode;
+        uint32_t usb_flush_deadline_us;
+        Usb_flush_stats usb_flush_stats;
+        Route_latency route_latency[MIDI2USBHUB_MAX_LATENCY_ROUTES];
+        Route_transform route_transforms[MIDI2USBHUB_MAX_ROUTE_TRANSFORMS]; // an empty entry is free
+        Held_notes transform_held_notes[MIDI2USBHUB_MAX_ROUTE_TRANSFORMS];  // the notes each route transform turned on
+        // Note Offs for the held notes of changed route transforms. Only the
+        // routing core may send to a MIDI OUT port, so they wait here for it.
+        Packet_pool<Midi_event, MIDI2USBHUB_NOTE_OFF_POOL_SIZE> note_off_pool;
+        Packet_list note_off_list;
+        Input_zones keyboard_zones[MIDI2USBHUB_MAX_ZONED_INPUTS];
+        // The MIDI IN port each keyboard zone table entry belongs to, or last
+        // belonged to if it is free. An entry keeps its held notes until it
+        // passes to another port.
+        struct Zones_owner
+        {
+            bool in_use;
+            uint8_t devaddr; // 0 if no port has used the entry
+            uint8_t cable;
+        };
+        Zones_owner keyboard_zones_owner[MIDI2USBHUB_MAX_ZONED_INPUTS];
+        uint32_t untracked_route_messages; // messages on routes that did not fit in route_latency
+
+        // set from interrupt handlers or the other core; cleared by the core that does the work
+        volatile bool console_rx_pending;
+        volatile uint32_t console_rx_time;
+        volatile bool usb_host_doorbell;
+        volatile uint32_t usb_host_doorbell_time;
+        volatile bool out_queue_refill;     // flush_usb_tx() made room in a USB device transmit queue
+        bool uart_rx_active;                // last poll of the UART MIDI IN found bytes
+        bool has_uart_rx_carry;             // uart_rx_carry holds a byte the next poll routes first
+        uint8_t uart_rx_carry;              // the byte that showed a full poll left bytes behind
+        bool uart_thru;                     // copy UART MIDI IN bytes straight to the UART MIDI OUT
+        bool usb_rx_blocked;                // usb_rx_queue waits for room in a block_source MIDI OUT queue
+        bool out_queue_throttled;           // a MIDI OUT queue waits for its rate limit or its fixed latency
+        absolute_time_t out_queue_throttled_until; // when the first throttled MIDI OUT queue may send again
+        absolute_time_t uart_tx_busy_until; // estimated time the UART MIDI OUT sends the last byte midi_uart_lib has
+        absolute_time_t led_timestamp;
+        Idle_stats idle_stats[2];           // indexed by core number
         Midi2usbhub_cli cli;
     };
 }
\ No newline at end of file
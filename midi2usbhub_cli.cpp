@@ -36,7 +36,7 @@ rppicomidi::Midi2usbhub_cli::Midi2usbhub_cli(Preset_manager* pm)
         .rxBufferSize = 64,
         .cmdBufferSize = 64,
         .historyBufferSize = 128,
-        .maxBindingCount = static_cast<uint16_t>(6 +
+        .maxBindingCount = static_cast<uint16_t>(22 +
                             Preset_manager_cli::get_num_commands() +
                             Pico_lfs_cli::get_num_commands() +
                             Pico_fatfs_cli::get_num_commands()),
@@ -60,8 +60,8 @@ rppicomidi::Midi2usbhub_cli::Midi2usbhub_cli(Preset_manager* pm)
                                        static_disconnect});
     assert(result);
     result = embeddedCliAddBinding(cli, {"list",
-                                       "List all connected MIDI Devices: usage: list",
-                                       false,
+                                       "List all connected MIDI Devices: usage: list [stats]",
+                                       true,
                                        this,
                                        static_list});
     assert(result);
@@ -83,6 +83,102 @@ rppicomidi::Midi2usbhub_cli::Midi2usbhub_cli(Preset_manager* pm)
                                        this,
                                        static_show});
     assert(result);
+    result = embeddedCliAddBinding(cli, {"running-status",
+                                       "Show or set MIDI OUT A running status. usage: running-status [on|off] [vel0]",
+                                       true,
+                                       this,
+                                       static_running_status});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"pipeline",
+                                       "Show or reset MIDI routing latency statistics. usage: pipeline [reset]",
+                                       true,
+                                       this,
+                                       static_pipeline});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"idle",
+                                       "Show or reset processor core idle statistics. usage: idle [reset]",
+                                       true,
+                                       this,
+                                       static_idle});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"latency",
+                                       "Show or reset per route MIDI latency histograms. usage: latency [reset]",
+                                       true,
+                                       this,
+                                       static_latency});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"stats",
+                                       "Show or reset MIDI port traffic counters. usage: stats [reset]",
+                                       true,
+                                       this,
+                                       static_stats});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"merge",
+                                       "Show merge statistics or set the SysEx timeout. usage: merge [reset|timeout <ms>]",
+                                       true,
+                                       this,
+                                       static_merge});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"queue",
+                                       "Show MIDI OUT queues or set one. usage: queue [reset|<TO nickname> [depth <n>] [policy newest|oldest|block] [thin on|off]]",
+                                       true,
+                                       this,
+                                       static_queue});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"flush",
+                                       "Show USB OUT transfer statistics or set when transfers start. usage: flush [reset|latency|throughput|deadline <us>]",
+                                       true,
+                                       this,
+                                       static_flush});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"inputs",
+                                       "Show MIDI source starvation statistics or set the input budget. usage: inputs [reset|budget <n>]",
+                                       true,
+                                       this,
+                                       static_inputs});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"profile",
+                                       "Show, set or save USB device pacing profiles. usage: profile [save|load|delete <vid> <pid>|<vid> <pid> [rate <n>] [gap <us>] [flush latency|throughput|default]]",
+                                       true,
+                                       this,
+                                       static_profile});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"jitter",
+                                       "Show fixed latency jitter statistics or set a TO terminal's fixed latency. usage: jitter [reset|<TO nickname> off|<us>]",
+                                       true,
+                                       this,
+                                       static_jitter});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"delay",
+                                       "Show route delays or delay a connection. usage: delay [<FROM nickname> <TO nickname> <ms>]",
+                                       true,
+                                       this,
+                                       static_delay});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"thru",
+                                       "Show or set the serial port MIDI thru mode; thru bytes skip queue, delay, jitter, running-status and the rate limit. usage: thru [on|off]",
+                                       true,
+                                       this,
+                                       static_thru});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"filter",
+                                       "Show route filters or set one. usage: filter [<FROM nickname> <TO nickname> all|pass <what>...|block <what>...]",
+                                       true,
+                                       this,
+                                       static_filter});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"transform",
+                                       "Show route transforms or change one. usage: transform [<FROM nickname> <TO nickname> clear|remove <n>|add <stage>]",
+                                       true,
+                                       this,
+                                       static_transform});
+    assert(result);
+    result = embeddedCliAddBinding(cli, {"zone",
+                                       "Show keyboard zones or change one. usage: zone [<FROM nickname> [<n>] off|<FROM nickname> <n> <lowest> <highest> <TO nickname>...]",
+                                       true,
+                                       this,
+                                       static_zone});
+    assert(result);
     (void)result;
     Preset_manager_cli pm_cli(cli, pm);
     Pico_lfs_cli lfs_cli(cli);
@@ -99,9 +195,18 @@ void rppicomidi::Midi2usbhub_cli::task()
     }
 }
 
-void rppicomidi::Midi2usbhub_cli::static_list(EmbeddedCli *, char *, void *)
+void rppicomidi::Midi2usbhub_cli::static_list(EmbeddedCli *, char *args, void *)
 {
-    printf("USB ID      Port  Direction Nickname     Product Name\n");
+    auto ntokens = embeddedCliGetTokenCount(args);
+    bool show_stats = ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "stats";
+    if (ntokens != 0 && !show_stats) {
+        printf("usage: list [stats]\r\n");
+        return;
+    }
+    if (show_stats)
+        printf("USB ID      Port  Direction Nickname       Messages      Drops Product Name\n");
+    else
+        printf("USB ID      Port  Direction Nickname     Product Name\n");
 
     for (size_t addr = 1; addr <= CFG_TUH_DEVICE_MAX + 1; addr++)
     {
@@ -113,15 +218,26 @@ void rppicomidi::Midi2usbhub_cli::static_list(EmbeddedCli *, char *, void *)
             {
                 if (in_port->devaddr == addr)
                 {
-                    printf("%04x-%04x    %-2d     %s    %-12s %s\r\n", dev->vid, dev->pid, in_port->cable + 1,
-                           "FROM", in_port->nickname.c_str(), dev->product_name.c_str());
+                    if (show_stats)
+                        printf("%04x-%04x    %-2d     %s    %-12s %10lu %10lu %s\r\n", dev->vid, dev->pid, in_port->cable + 1,
+                               "FROM", in_port->nickname.c_str(), in_port->stats.messages, in_port->stats.get_drops(),
+                               dev->product_name.c_str());
+                    else
+                        printf("%04x-%04x    %-2d     %s    %-12s %s\r\n", dev->vid, dev->pid, in_port->cable + 1,
+                               "FROM", in_port->nickname.c_str(), dev->product_name.c_str());
                     for (auto out_port : Midi2usbhub::instance().get_midi_out_port_list())
                     {
                         if (out_port->devaddr == addr && out_port->cable == in_port->cable)
                         {
-                            printf("%04x-%04x    %-2d     %s    %-12s %s\r\n", dev->vid, dev->pid,
-                                   out_port->cable + 1,
-                                   " TO ", out_port->nickname.c_str(), dev->product_name.c_str());
+                            if (show_stats)
+                                printf("%04x-%04x    %-2d     %s    %-12s %10lu %10lu %s\r\n", dev->vid, dev->pid,
+                                       out_port->cable + 1,
+                                       " TO ", out_port->nickname.c_str(), out_port->stats.messages,
+                                       out_port->stats.get_drops(), dev->product_name.c_str());
+                            else
+                                printf("%04x-%04x    %-2d     %s    %-12s %s\r\n", dev->vid, dev->pid,
+                                       out_port->cable + 1,
+                                       " TO ", out_port->nickname.c_str(), dev->product_name.c_str());
                             break;
                         }
                     }
@@ -140,17 +256,32 @@ void rppicomidi::Midi2usbhub_cli::static_connect(EmbeddedCli *cli, char *args, v
     }
     auto from_nickname = std::string(embeddedCliGetToken(args, 1));
     auto to_nickname = std::string(embeddedCliGetToken(args, 2));
-    switch (Midi2usbhub::instance().connect(from_nickname, to_nickname)) {
+    auto& hub = Midi2usbhub::instance();
+    switch (hub.connect(from_nickname, to_nickname)) {
         case 0:
             printf("%s connect to %s: successful\r\n",
                            from_nickname.c_str(), to_nickname.c_str());
             break;
+        case 1:
+            printf("%s connect to %s: successful\r\n",
+                           from_nickname.c_str(), to_nickname.c_str());
+            for (auto out_port : hub.get_midi_out_port_list()) {
+                if (out_port->nickname == to_nickname) {
+                    printf("Warning: the FROM ports routed to %s have peaked at %lu bytes/s; it can send %lu bytes/s\r\n",
+                           to_nickname.c_str(), hub.get_routed_peak_bytes_per_second(out_port),
+                           out_port->shaper.get_bytes_per_second());
+                }
+            }
+            break;
         case -1:
             printf("TO nickname %s not found\r\n", to_nickname.c_str());
             break;
         case -2:
             printf("FROM nickname %s not found\r\n", from_nickname.c_str());
             break;
+        case -3:
+            printf("%s is in thru mode; only the serial port MIDI IN can connect to it\r\n", to_nickname.c_str());
+            break;
         default:
             printf("unknown return from connect()\r\n");
             break;
@@ -227,14 +358,7 @@ void rppicomidi::Midi2usbhub_cli::static_show(EmbeddedCli *, char *, void *)
         printf("%-12s|", midi_in->nickname.c_str());
         for (auto midi_out : Midi2usbhub::instance().get_midi_out_port_list())
         {
-            char connection_mark = ' ';
-            for (auto &sends_to : midi_in->sends_data_to_list)
-            {
-                if (sends_to == midi_out)
-                {
-                    connection_mark = 'x';
-                }
-            }
+            char connection_mark = midi_in->sends_data_to.test(midi_out->index) ? 'x' : ' ';
             printf(" %c |", connection_mark);
         }
         printf("\r\n------------+");
@@ -273,3 +397,825 @@ void rppicomidi::Midi2usbhub_cli::static_rename(EmbeddedCli *cli, char *args, vo
             break;
     }
 }
+
+void rppicomidi::Midi2usbhub_cli::static_running_status(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& encoder = Midi2usbhub::instance().get_uart_tx_encoder();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens > 2) {
+        printf("usage: running-status [on|off] [vel0]\r\n");
+        return;
+    }
+    if (ntokens > 0) {
+        auto on_off = std::string(embeddedCliGetToken(args, 1));
+        bool vel0 = false;
+        if (ntokens == 2) {
+            if (std::string(embeddedCliGetToken(args, 2)) != "vel0") {
+                printf("usage: running-status [on|off] [vel0]\r\n");
+                return;
+            }
+            vel0 = true;
+        }
+        if (on_off == "on") {
+            encoder.set_enabled(true);
+            encoder.set_note_off_as_note_on(vel0);
+        }
+        else if (on_off == "off" && !vel0) {
+            encoder.set_enabled(false);
+            encoder.set_note_off_as_note_on(false);
+        }
+        else {
+            printf("usage: running-status [on|off] [vel0]\r\n");
+            return;
+        }
+    }
+    printf("MIDI OUT A running status %s, Note Off as Note On velocity 0 %s\r\n",
+           encoder.get_enabled() ? "on" : "off", encoder.get_note_off_as_note_on() ? "on" : "off");
+    printf("bytes saved: %lu in the last second, %lu peak per second, %llu of %llu total\r\n",
+           encoder.get_bytes_saved_last_second(), encoder.get_peak_bytes_saved_per_second(),
+           encoder.get_total_bytes_in() - encoder.get_total_bytes_out(), encoder.get_total_bytes_in());
+}
+
+void rppicomidi::Midi2usbhub_cli::static_pipeline(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& stats = Midi2usbhub::instance().get_pipeline_stats();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "reset") {
+        stats.reset();
+        printf("pipeline statistics reset\r\n");
+        return;
+    }
+    else if (ntokens != 0) {
+        printf("usage: pipeline [reset]\r\n");
+        return;
+    }
+    printf("%s core MIDI routing\r\n", MIDI2USBHUB_DUAL_CORE ? "Dual" : "Single");
+    printf("To USB OUT:  %lu messages, average latency %lu us, max %lu us\r\n",
+           stats.usb_out_latency.count, stats.usb_out_latency.get_average_us(), stats.usb_out_latency.max_us);
+    printf("To UART OUT: %lu messages, average latency %lu us, max %lu us\r\n",
+           stats.uart_out_latency.count, stats.uart_out_latency.get_average_us(), stats.uart_out_latency.max_us);
+    printf("USB receive queue high water %u of %u, full %lu times\r\n",
+           Midi2usbhub::instance().get_usb_rx_queue_high_water(), MIDI2USBHUB_USB_RX_QUEUE_SIZE, stats.usb_rx_queue_full);
+    printf("Dropped: %lu USB packets\r\n", stats.usb_tx_dropped);
+}
+
+void rppicomidi::Midi2usbhub_cli::static_idle(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "reset") {
+        hub.get_idle_stats(0).reset();
+        hub.get_idle_stats(1).reset();
+        printf("idle statistics reset\r\n");
+        return;
+    }
+    else if (ntokens != 0) {
+        printf("usage: idle [reset]\r\n");
+        return;
+    }
+    printf("Idle mode: %s\r\n", MIDI2USBHUB_IDLE_WFE ? "wait for event" : "busy polling");
+    for (uint core = 0; core < (MIDI2USBHUB_DUAL_CORE ? 2 : 1); core++) {
+        auto& stats = hub.get_idle_stats(core);
+        uint64_t elapsed = time_us_64() - stats.since_us;
+        uint32_t idle_tenths = elapsed ? static_cast<uint32_t>(stats.idle_us * 1000 / elapsed) : 0;
+        printf("Core %u: idle %lu.%lu%%, %lu sleeps, wake latency average %lu us, max %lu us\r\n",
+               core, idle_tenths / 10, idle_tenths % 10, stats.sleeps,
+               stats.wake_latency.get_average_us(), stats.wake_latency.max_us);
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_latency(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "reset") {
+        hub.reset_route_latency();
+        printf("route latency histograms reset\r\n");
+        return;
+    }
+    else if (ntokens != 0) {
+        printf("usage: latency [reset]\r\n");
+        return;
+    }
+    bool found = false;
+    for (size_t idx = 0; idx < MIDI2USBHUB_MAX_LATENCY_ROUTES; idx++) {
+        auto entry = hub.get_route_latency(idx);
+        if (!entry->in_use || entry->histogram.get_count() == 0)
+            continue;
+        auto in_port = hub.get_midi_in_port(entry->from_devaddr, entry->from_cable);
+        auto out_port = hub.get_midi_out_port(entry->to_index);
+        if (in_port == nullptr || out_port == nullptr)
+            continue;
+        found = true;
+        auto& histogram = entry->histogram;
+        printf("%s->%s: %lu messages, max %lu us\r\n", in_port->nickname.c_str(), out_port->nickname.c_str(),
+               histogram.get_count(), histogram.get_max_us());
+        for (uint8_t bucket = 0; bucket < Latency_histogram::num_buckets; bucket++) {
+            uint32_t count = histogram.get_bucket(bucket);
+            if (count == 0)
+                continue;
+            if (bucket + 1 == Latency_histogram::num_buckets)
+                printf("    %lu us and up: %lu\r\n", Latency_histogram::get_bucket_min_us(bucket), count);
+            else
+                printf("    %lu-%lu us: %lu\r\n", Latency_histogram::get_bucket_min_us(bucket),
+                       Latency_histogram::get_bucket_max_us(bucket), count);
+        }
+    }
+    if (!found)
+        printf("no MIDI messages routed since the last reset\r\n");
+    if (hub.get_untracked_route_messages() != 0)
+        printf("%lu messages on routes without a histogram\r\n", hub.get_untracked_route_messages());
+}
+
+void rppicomidi::Midi2usbhub_cli::static_stats(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "reset") {
+        hub.reset_port_stats();
+        printf("port statistics reset\r\n");
+        return;
+    }
+    else if (ntokens != 0) {
+        printf("usage: stats [reset]\r\n");
+        return;
+    }
+    printf("Direction Nickname       Messages      Bytes      Drops  Peak msg/s    Peak B/s   Limit B/s\r\n");
+    for (auto in_port : hub.get_midi_in_port_list()) {
+        auto& stats = in_port->stats;
+        printf("  FROM    %-12s %10lu %10lu %10lu %10lu  %10lu\r\n", in_port->nickname.c_str(),
+               stats.messages, stats.bytes, stats.get_drops(), stats.peak_per_second, stats.peak_bytes_per_second);
+    }
+    for (auto out_port : hub.get_midi_out_port_list()) {
+        auto& stats = out_port->stats;
+        printf("   TO     %-12s %10lu %10lu %10lu %10lu  %10lu  %10lu\r\n", out_port->nickname.c_str(),
+               stats.messages, stats.bytes, stats.get_drops(), stats.peak_per_second, stats.peak_bytes_per_second,
+               out_port->shaper.get_bytes_per_second());
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_merge(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "reset") {
+        hub.reset_merge_stats();
+        printf("merge statistics reset\r\n");
+        return;
+    }
+    else if (ntokens == 2 && std::string(embeddedCliGetToken(args, 1)) == "timeout") {
+        int timeout_ms = atoi(embeddedCliGetToken(args, 2));
+        if (timeout_ms < 1) {
+            printf("SysEx timeout must be at least 1 ms\r\n");
+            return;
+        }
+        hub.set_sysex_timeout_ms(timeout_ms);
+    }
+    else if (ntokens != 0) {
+        printf("usage: merge [reset|timeout <ms>]\r\n");
+        return;
+    }
+    printf("SysEx timeout %lu ms; held message pool high water %u of %u\r\n", hub.get_sysex_timeout_ms(),
+           hub.get_merge_hold_high_water(), MIDI2USBHUB_MERGE_HOLD_POOL_SIZE);
+    printf("Nickname         Waits  Avg wait us  Max wait us   Timeouts    Orphans      Drops\r\n");
+    for (auto out_port : hub.get_midi_out_port_list()) {
+        auto& stats = out_port->merge_stats;
+        printf("%-12s %10lu   %10lu   %10lu %10lu %10lu %10lu\r\n", out_port->nickname.c_str(), stats.wait.count,
+               stats.wait.get_average_us(), stats.wait.max_us, stats.sysex_timeouts, stats.sysex_orphans, stats.hold_drops);
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_queue(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    static const char* policy_names[] = {"newest", "oldest", "block"};
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "reset") {
+        hub.reset_out_queue_stats();
+        printf("queue statistics reset\r\n");
+        return;
+    }
+    else if (ntokens != 0 && ntokens % 2 == 0) {
+        printf("usage: queue [reset|<TO nickname> [depth <n>] [policy newest|oldest|block] [thin on|off]]\r\n");
+        return;
+    }
+    else if (ntokens != 0) {
+        std::string nickname = embeddedCliGetToken(args, 1);
+        Midi2usbhub::Midi_out_port* out_port = nullptr;
+        for (auto port : hub.get_midi_out_port_list()) {
+            if (port->nickname == nickname)
+                out_port = port;
+        }
+        if (out_port == nullptr) {
+            printf("TO nickname %s not found\r\n", nickname.c_str());
+            return;
+        }
+        int depth = out_port->queue.depth;
+        auto policy = out_port->queue.policy;
+        bool thin = out_port->queue.thin;
+        for (uint16_t token = 2; token < ntokens; token += 2) {
+            std::string option = embeddedCliGetToken(args, token);
+            std::string value = embeddedCliGetToken(args, token + 1);
+            if (option == "depth") {
+                depth = atoi(value.c_str());
+            }
+            else if (option == "policy") {
+                if (value == policy_names[0])
+                    policy = Midi2usbhub::Overflow_policy::drop_newest;
+                else if (value == policy_names[1])
+                    policy = Midi2usbhub::Overflow_policy::drop_oldest;
+                else if (value == policy_names[2])
+                    policy = Midi2usbhub::Overflow_policy::block_source;
+                else {
+                    printf("unknown policy %s\r\n", value.c_str());
+                    return;
+                }
+            }
+            else if (option == "thin" && (value == "on" || value == "off")) {
+                thin = value == "on";
+            }
+            else {
+                printf("unknown option %s %s\r\n", option.c_str(), value.c_str());
+                return;
+            }
+        }
+        if (depth < 1 || depth > MIDI2USBHUB_OUT_QUEUE_POOL_SIZE || !hub.set_out_queue(out_port, depth, policy, thin)) {
+            printf("queue depth must be 1-%u\r\n", MIDI2USBHUB_OUT_QUEUE_POOL_SIZE);
+            return;
+        }
+    }
+    printf("shared queue pool high water %u of %u\r\n", hub.get_out_queue_pool_high_water(), MIDI2USBHUB_OUT_QUEUE_POOL_SIZE);
+    printf("Nickname      Depth Policy  Queued High water      Drops    Blocked  Throttled    Thinned\r\n");
+    for (auto out_port : hub.get_midi_out_port_list()) {
+        auto& queue = out_port->queue;
+        printf("%-12s %6u %-6s %7u %10u %10lu %10lu %10lu ", out_port->nickname.c_str(), queue.depth,
+               policy_names[static_cast<uint8_t>(queue.policy)], queue.packets.count, queue.high_water,
+               out_port->stats.routing_core_drops, queue.blocked, queue.throttled);
+        if (queue.thin)
+            printf("%10lu\r\n", queue.thinned);
+        else
+            printf("%10s\r\n", "off");
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_flush(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto& stats = hub.get_usb_flush_stats();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    std::string arg = ntokens > 0 ? embeddedCliGetToken(args, 1) : "";
+    if (ntokens == 1 && arg == "reset") {
+        stats.reset();
+        printf("USB transfer statistics reset\r\n");
+        return;
+    }
+    else if (ntokens == 1 && arg == "latency") {
+        hub.set_usb_flush_mode(Midi2usbhub::Usb_flush_mode::latency);
+    }
+    else if (ntokens == 1 && arg == "throughput") {
+        hub.set_usb_flush_mode(Midi2usbhub::Usb_flush_mode::throughput);
+    }
+    else if (ntokens == 2 && arg == "deadline") {
+        int deadline_us = atoi(embeddedCliGetToken(args, 2));
+        if (deadline_us < 1 || deadline_us > 100000) {
+            printf("flush deadline must be 1-100000 us\r\n");
+            return;
+        }
+        hub.set_usb_flush_deadline_us(deadline_us);
+    }
+    else if (ntokens != 0) {
+        printf("usage: flush [reset|latency|throughput|deadline <us>]\r\n");
+        return;
+    }
+    bool throughput = hub.get_usb_flush_mode() == Midi2usbhub::Usb_flush_mode::throughput;
+    printf("%s mode; flush deadline %lu us\r\n", throughput ? "Throughput" : "Latency", hub.get_usb_flush_deadline_us());
+    uint32_t elapsed_ms = static_cast<uint32_t>((time_us_64() - stats.since_us) / 1000);
+    uint32_t per_second = elapsed_ms == 0 ? 0 : static_cast<uint32_t>(stats.transfers * 1000ull / elapsed_ms);
+    uint32_t per_transfer = stats.transfers == 0 ? 0 : stats.bytes / stats.transfers;
+    printf("%lu transfers in %lu ms (%lu per second), %lu bytes, average %lu bytes per transfer\r\n",
+           stats.transfers, elapsed_ms, per_second, stats.bytes, per_transfer);
+    if (throughput)
+        printf("started full: %lu, at the deadline: %lu\r\n", stats.full_flushes, stats.deadline_flushes);
+}
+
+void rppicomidi::Midi2usbhub_cli::static_inputs(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "reset") {
+        hub.reset_input_stats();
+        printf("input statistics reset\r\n");
+        return;
+    }
+    else if (ntokens == 2 && std::string(embeddedCliGetToken(args, 1)) == "budget") {
+        int budget = atoi(embeddedCliGetToken(args, 2));
+        if (budget < 1 || budget > MIDI2USBHUB_USB_RX_QUEUE_SIZE / CFG_TUH_DEVICE_MAX) {
+            printf("input budget must be 1-%u\r\n", MIDI2USBHUB_USB_RX_QUEUE_SIZE / CFG_TUH_DEVICE_MAX);
+            return;
+        }
+        hub.set_input_budget(budget);
+    }
+    else if (ntokens != 0) {
+        printf("usage: inputs [reset|budget <n>]\r\n");
+        return;
+    }
+    printf("Input budget %u packets per source per pass\r\n", hub.get_input_budget());
+    printf("Addr Product              Passes   Deferred  Avg wait us  Max wait us\r\n");
+    for (size_t addr = 1; addr <= CFG_TUH_DEVICE_MAX + 1; addr++) {
+        auto info = hub.get_attached_device(addr);
+        if (!info || !info->configured)
+            continue;
+        auto stats = hub.get_input_stats(addr);
+        printf("%4u %-18s %8lu %10lu ", static_cast<unsigned>(addr), info->product_name.substr(0, 18).c_str(), stats->passes, stats->deferred);
+        if (stats->wait.count == 0)
+            printf("%12s %12s\r\n", "-", "-");
+        else
+            printf("%12lu %12lu\r\n", stats->wait.get_average_us(), stats->wait.max_us);
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_profile(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    static const char* usage = "usage: profile [save|load|delete <vid> <pid>|<vid> <pid> [rate <n>] [gap <us>] [flush latency|throughput|default]]\r\n";
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    std::string arg = ntokens > 0 ? embeddedCliGetToken(args, 1) : "";
+    if (ntokens == 1 && arg == "save") {
+        if (hub.save_device_profiles())
+            printf("device profiles saved\r\n");
+        return;
+    }
+    else if (ntokens == 1 && arg == "load") {
+        if (hub.load_device_profiles())
+            printf("device profiles loaded\r\n");
+        else
+            printf("no device profiles loaded\r\n");
+        return;
+    }
+    else if (ntokens == 3 && arg == "delete") {
+        uint16_t vid = strtoul(embeddedCliGetToken(args, 2), nullptr, 16);
+        uint16_t pid = strtoul(embeddedCliGetToken(args, 3), nullptr, 16);
+        if (!hub.delete_device_profile(vid, pid))
+            printf("no profile for %04x-%04x\r\n", vid, pid);
+        return;
+    }
+    else if (ntokens >= 2 && ntokens % 2 == 0) {
+        Midi2usbhub::Device_profile profile{};
+        profile.vid = strtoul(embeddedCliGetToken(args, 1), nullptr, 16);
+        profile.pid = strtoul(embeddedCliGetToken(args, 2), nullptr, 16);
+        for (auto& existing : hub.get_device_profiles()) {
+            if (existing.vid == profile.vid && existing.pid == profile.pid)
+                profile = existing;
+        }
+        for (uint16_t token = 3; token < ntokens; token += 2) {
+            std::string option = embeddedCliGetToken(args, token);
+            std::string value = embeddedCliGetToken(args, token + 1);
+            if (option == "rate") {
+                profile.max_packets_per_second = strtoul(value.c_str(), nullptr, 10);
+            }
+            else if (option == "gap") {
+                profile.sysex_gap_us = strtoul(value.c_str(), nullptr, 10);
+            }
+            else if (option == "flush" && value == "default") {
+                profile.use_flush_mode = false;
+            }
+            else if (option == "flush" && (value == "latency" || value == "throughput")) {
+                profile.use_flush_mode = true;
+                profile.flush_mode = value == "latency" ? Midi2usbhub::Usb_flush_mode::latency : Midi2usbhub::Usb_flush_mode::throughput;
+            }
+            else {
+                printf("unknown option %s %s\r\n", option.c_str(), value.c_str());
+                return;
+            }
+        }
+        hub.set_device_profile(profile);
+    }
+    else if (ntokens != 0) {
+        printf("%s", usage);
+        return;
+    }
+    printf("Device     Max packets/s SysEx gap us  Flush\r\n");
+    for (auto& profile : hub.get_device_profiles()) {
+        const char* flush = "default";
+        if (profile.use_flush_mode)
+            flush = profile.flush_mode == Midi2usbhub::Usb_flush_mode::latency ? "latency" : "throughput";
+        printf("%04x-%04x  ", profile.vid, profile.pid);
+        if (profile.max_packets_per_second == 0)
+            printf("%13s", "no limit");
+        else
+            printf("%13lu", profile.max_packets_per_second);
+        printf(" %12lu  %s\r\n", profile.sysex_gap_us, flush);
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_jitter(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 && std::string(embeddedCliGetToken(args, 1)) == "reset") {
+        hub.reset_release_error_stats();
+        printf("jitter statistics reset\r\n");
+        return;
+    }
+    else if (ntokens == 2) {
+        std::string nickname = embeddedCliGetToken(args, 1);
+        Midi2usbhub::Midi_out_port* out_port = nullptr;
+        for (auto port : hub.get_midi_out_port_list()) {
+            if (port->nickname == nickname)
+                out_port = port;
+        }
+        if (out_port == nullptr) {
+            printf("TO nickname %s not found\r\n", nickname.c_str());
+            return;
+        }
+        std::string value = embeddedCliGetToken(args, 2);
+        int fixed_latency_us = value == "off" ? 0 : atoi(value.c_str());
+        if ((fixed_latency_us < 1 && value != "off") || !hub.set_fixed_latency(out_port, fixed_latency_us)) {
+            printf("fixed latency must be off or 1-%u us\r\n", MIDI2USBHUB_MAX_FIXED_LATENCY_US);
+            return;
+        }
+    }
+    else if (ntokens != 0) {
+        printf("usage: jitter [reset|<TO nickname> off|<us>]\r\n");
+        return;
+    }
+    printf("Nickname      Fixed us   Messages Avg jitter us Max jitter us\r\n");
+    for (auto out_port : hub.get_midi_out_port_list()) {
+        if (out_port->fixed_latency_us == 0) {
+            printf("%-12s %9s\r\n", out_port->nickname.c_str(), "off");
+            continue;
+        }
+        auto& error = out_port->release_error;
+        printf("%-12s %9lu %10lu %13lu %13lu\r\n", out_port->nickname.c_str(), out_port->fixed_latency_us,
+               error.count, error.get_average_us(), error.max_us);
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_delay(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 3) {
+        auto from_nickname = std::string(embeddedCliGetToken(args, 1));
+        auto to_nickname = std::string(embeddedCliGetToken(args, 2));
+        int delay_ms = atoi(embeddedCliGetToken(args, 3));
+        switch (delay_ms < 0 ? -3 : hub.set_route_delay(from_nickname, to_nickname, delay_ms)) {
+            case 0:
+                break;
+            case -1:
+                printf("TO nickname %s not found or not connected to %s\r\n", to_nickname.c_str(), from_nickname.c_str());
+                return;
+            case -2:
+                printf("FROM nickname %s not found\r\n", from_nickname.c_str());
+                return;
+            default:
+                printf("delay must be 0-%u ms\r\n", MIDI2USBHUB_MAX_ROUTE_DELAY_MS);
+                return;
+        }
+    }
+    else if (ntokens != 0) {
+        printf("usage: delay [<FROM nickname> <TO nickname> <ms>]\r\n");
+        return;
+    }
+    printf("delay line pool high water %u of %u, %u waiting now\r\n", hub.get_delay_pool_high_water(),
+           MIDI2USBHUB_DELAY_POOL_SIZE, hub.get_num_delayed_packets());
+    printf("FROM         TO           Delay ms\r\n");
+    for (auto in_port : hub.get_midi_in_port_list()) {
+        in_port->sends_data_to.for_each([&](size_t idx) {
+            auto out_port = hub.get_midi_out_port(idx);
+            if (out_port != nullptr && in_port->delay_ms[idx] != 0)
+                printf("%-12s %-12s %8u\r\n", in_port->nickname.c_str(), out_port->nickname.c_str(), in_port->delay_ms[idx]);
+        });
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_thru(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    std::string arg = ntokens > 0 ? embeddedCliGetToken(args, 1) : "";
+    if (ntokens == 1 && (arg == "on" || arg == "off")) {
+        if (!hub.set_uart_thru(arg == "on")) {
+            printf("disconnect the other FROM ports from the serial port MIDI OUT first\r\n");
+            return;
+        }
+    }
+    else if (ntokens != 0) {
+        printf("usage: thru [on|off]\r\n");
+        return;
+    }
+    printf("serial port MIDI thru mode %s\r\n", hub.get_uart_thru() ? "on" : "off");
+}
+
+void rppicomidi::Midi2usbhub_cli::static_filter(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto print_usage = []() {
+        printf("usage: filter [<FROM nickname> <TO nickname> all|pass <what>...|block <what>...]\r\n");
+        printf("<what> is ch1-ch16 or one of the message classes");
+        for (uint8_t cls = 0; cls < Route_filter::num_classes; cls++)
+            printf(" %s", Route_filter::get_class_name(static_cast<Route_filter::Message_class>(cls)));
+        printf("\r\n");
+    };
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 || ntokens == 2) {
+        print_usage();
+        return;
+    }
+    else if (ntokens != 0) {
+        auto from_nickname = std::string(embeddedCliGetToken(args, 1));
+        auto to_nickname = std::string(embeddedCliGetToken(args, 2));
+        std::string action = embeddedCliGetToken(args, 3);
+        Route_filter filter;
+        for (auto in_port : hub.get_midi_in_port_list()) {
+            for (auto out_port : hub.get_midi_out_port_list()) {
+                if (in_port->nickname == from_nickname && out_port->nickname == to_nickname)
+                    filter = in_port->filter[out_port->index];
+            }
+        }
+        if (action == "all" && ntokens == 3) {
+            filter.set_all(true);
+        }
+        else if ((action == "pass" || action == "block") && ntokens > 3) {
+            bool pass = action == "pass";
+            for (uint16_t token = 4; token <= ntokens; token++) {
+                std::string what = embeddedCliGetToken(args, token);
+                Route_filter::Message_class cls;
+                int channel = what.rfind("ch", 0) == 0 ? atoi(what.c_str() + 2) : 0;
+                if (channel >= 1 && channel <= 16) {
+                    filter.set_channel(channel, pass);
+                }
+                else if (Route_filter::find_class(what.c_str(), cls)) {
+                    filter.set_class(cls, pass);
+                }
+                else {
+                    printf("unknown channel or message class %s\r\n", what.c_str());
+                    return;
+                }
+            }
+        }
+        else {
+            print_usage();
+            return;
+        }
+        switch (hub.set_route_filter(from_nickname, to_nickname, filter)) {
+            case 0:
+                break;
+            case -1:
+                printf("TO nickname %s not found or not connected to %s\r\n", to_nickname.c_str(), from_nickname.c_str());
+                return;
+            default:
+                printf("FROM nickname %s not found\r\n", from_nickname.c_str());
+                return;
+        }
+    }
+    printf("FROM         TO           Blocks\r\n");
+    for (auto in_port : hub.get_midi_in_port_list()) {
+        in_port->sends_data_to.for_each([&](size_t idx) {
+            auto out_port = hub.get_midi_out_port(idx);
+            auto& filter = in_port->filter[idx];
+            if (out_port == nullptr || filter.passes_all())
+                return;
+            printf("%-12s %-12s", in_port->nickname.c_str(), out_port->nickname.c_str());
+            for (uint8_t channel = 1; channel <= 16; channel++) {
+                if ((filter.get_channels() & (1u << (channel - 1))) == 0)
+                    printf(" ch%u", channel);
+            }
+            for (uint8_t cls = 0; cls < Route_filter::num_classes; cls++) {
+                if ((filter.get_classes() & (1u << cls)) == 0)
+                    printf(" %s", Route_filter::get_class_name(static_cast<Route_filter::Message_class>(cls)));
+            }
+            printf("\r\n");
+        });
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_transform(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto print_usage = []() {
+        printf("usage: transform [<FROM nickname> <TO nickname> clear|remove <n>|add <stage>]\r\n");
+        printf("<stage> is one of\r\n");
+        printf("  channel <from 1-16|all> <to 1-16>\r\n");
+        printf("  transpose <semitones> [<lowest note> <highest note>]\r\n");
+        printf("  cc <from 0-127> <to 0-127>\r\n");
+        printf("  velocity fixed <1-127>|range <min 1-127> <max 1-127>|curve <percent 10-1000>\r\n");
+    };
+    // parse the <stage> that starts at token first and add it to transform
+    auto add_stage = [&args](uint16_t first, uint16_t ntokens, Route_transform& transform) {
+        Route_transform::Stage_type type;
+        if (!Route_transform::find_stage_type(embeddedCliGetToken(args, first), type))
+            return false;
+        uint16_t nparams = ntokens - first;
+        int16_t params[3] = {0, 0, 0};
+        for (uint16_t idx = 0; idx < nparams && idx < 3; idx++)
+            params[idx] = static_cast<int16_t>(atoi(embeddedCliGetToken(args, first + 1 + idx)));
+        switch (type) {
+            case Route_transform::channel_map:
+                if (nparams != 2)
+                    return false;
+                if (strcmp(embeddedCliGetToken(args, first + 1), "all") == 0)
+                    params[0] = 0;
+                else if (params[0] == 0)
+                    return false;
+                break;
+            case Route_transform::transpose:
+                if (nparams == 1)
+                    params[2] = 127;
+                else if (nparams != 3)
+                    return false;
+                break;
+            case Route_transform::cc_map:
+                if (nparams != 2)
+                    return false;
+                break;
+            default:
+            {
+                Route_transform::Velocity_mode mode;
+                if (nparams < 2 || !Route_transform::find_velocity_mode(embeddedCliGetToken(args, first + 1), mode) ||
+                        nparams != (mode == Route_transform::range ? 3 : 2))
+                    return false;
+                params[0] = mode;
+                params[1] = static_cast<int16_t>(atoi(embeddedCliGetToken(args, first + 2)));
+                params[2] = nparams == 3 ? static_cast<int16_t>(atoi(embeddedCliGetToken(args, first + 3))) : 0;
+                break;
+            }
+        }
+        return transform.add_stage(type, params[0], params[1], params[2]);
+    };
+    auto print_stage = [](const Route_transform::Stage& stage) {
+        const int16_t* params = stage.params;
+        switch (stage.type) {
+            case Route_transform::channel_map:
+                if (params[0] == 0)
+                    printf("channel all->%d", params[1]);
+                else
+                    printf("channel %d->%d", params[0], params[1]);
+                break;
+            case Route_transform::transpose:
+                printf("transpose %+d notes %d-%d", params[0], params[1], params[2]);
+                break;
+            case Route_transform::cc_map:
+                printf("cc %d->%d", params[0], params[1]);
+                break;
+            default:
+                printf("velocity %s %d", Route_transform::get_velocity_mode_name(static_cast<Route_transform::Velocity_mode>(params[0])), params[1]);
+                if (params[0] == Route_transform::range)
+                    printf(" %d", params[2]);
+                break;
+        }
+    };
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    if (ntokens == 1 || ntokens == 2) {
+        print_usage();
+        return;
+    }
+    else if (ntokens != 0) {
+        auto from_nickname = std::string(embeddedCliGetToken(args, 1));
+        auto to_nickname = std::string(embeddedCliGetToken(args, 2));
+        std::string action = embeddedCliGetToken(args, 3);
+        Route_transform transform;
+        for (auto in_port : hub.get_midi_in_port_list()) {
+            for (auto out_port : hub.get_midi_out_port_list()) {
+                if (in_port->nickname == from_nickname && out_port->nickname == to_nickname) {
+                    auto current = hub.get_route_transform(in_port, out_port->index);
+                    if (current != nullptr)
+                        transform = *current;
+                }
+            }
+        }
+        if (action == "clear" && ntokens == 3) {
+            transform.clear();
+        }
+        else if (action == "remove" && ntokens == 4) {
+            int stage = atoi(embeddedCliGetToken(args, 4));
+            if (stage < 1 || !transform.remove_stage(stage - 1)) {
+                printf("no stage %s\r\n", embeddedCliGetToken(args, 4));
+                return;
+            }
+        }
+        else if (action == "add" && ntokens > 4) {
+            if (transform.get_num_stages() >= Route_transform::max_stages) {
+                printf("a transform has at most %u stages\r\n", Route_transform::max_stages);
+                return;
+            }
+            if (!add_stage(4, ntokens, transform)) {
+                print_usage();
+                return;
+            }
+        }
+        else {
+            print_usage();
+            return;
+        }
+        switch (hub.set_route_transform(from_nickname, to_nickname, transform)) {
+            case 0:
+                break;
+            case -1:
+                printf("TO nickname %s not found or not connected to %s\r\n", to_nickname.c_str(), from_nickname.c_str());
+                return;
+            case -2:
+                printf("FROM nickname %s not found\r\n", from_nickname.c_str());
+                return;
+            default:
+                printf("at most %u connections can have a transform\r\n", MIDI2USBHUB_MAX_ROUTE_TRANSFORMS);
+                return;
+        }
+    }
+    printf("FROM         TO           Stages\r\n");
+    for (auto in_port : hub.get_midi_in_port_list()) {
+        in_port->sends_data_to.for_each([&](size_t idx) {
+            auto out_port = hub.get_midi_out_port(idx);
+            auto transform = hub.get_route_transform(in_port, idx);
+            if (out_port == nullptr || transform == nullptr)
+                return;
+            for (uint8_t stage = 0; stage < transform->get_num_stages(); stage++) {
+                if (stage == 0)
+                    printf("%-12s %-12s", in_port->nickname.c_str(), out_port->nickname.c_str());
+                else
+                    printf("%-25s", "");
+                printf(" %u ", stage + 1);
+                print_stage(transform->get_stage(stage));
+                printf("\r\n");
+            }
+        });
+    }
+}
+
+void rppicomidi::Midi2usbhub_cli::static_zone(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    auto& hub = Midi2usbhub::instance();
+    auto ntokens = embeddedCliGetTokenCount(args);
+    int result = 0;
+    std::string from_nickname = ntokens > 0 ? embeddedCliGetToken(args, 1) : "";
+    int zone = ntokens > 1 ? atoi(embeddedCliGetToken(args, 2)) : 0;
+    if (ntokens == 2 && strcmp(embeddedCliGetToken(args, 2), "off") == 0) {
+        result = hub.remove_zone(from_nickname, Midi2usbhub::Input_zones::max_zones);
+    }
+    else if (ntokens == 3 && strcmp(embeddedCliGetToken(args, 3), "off") == 0 && zone >= 1 && zone <= Midi2usbhub::Input_zones::max_zones) {
+        result = hub.remove_zone(from_nickname, zone - 1);
+    }
+    else if (ntokens >= 5 && zone >= 1 && zone <= Midi2usbhub::Input_zones::max_zones) {
+        int lowest = atoi(embeddedCliGetToken(args, 3));
+        int highest = atoi(embeddedCliGetToken(args, 4));
+        std::vector<std::string> to_nicknames;
+        for (uint16_t token = 5; token <= ntokens; token++)
+            to_nicknames.push_back(embeddedCliGetToken(args, token));
+        result = lowest < 0 || highest > 127 ? -3 : hub.set_zone(from_nickname, zone - 1, lowest, highest, to_nicknames);
+    }
+    else if (ntokens != 0) {
+        printf("usage: zone [<FROM nickname> [<n>] off|<FROM nickname> <n> <lowest> <highest> <TO nickname>...]\r\n");
+        printf("<n> is 1-%u; <lowest> and <highest> are note numbers 0-127\r\n", Midi2usbhub::Input_zones::max_zones);
+        return;
+    }
+    switch (result) {
+        case 0:
+            break;
+        case -1:
+            printf("a TO nickname is not found or not connected to %s\r\n", from_nickname.c_str());
+            return;
+        case -2:
+            printf("FROM nickname %s not found\r\n", from_nickname.c_str());
+            return;
+        case -3:
+            printf("notes must be 0-127, lowest first, and not overlap another zone\r\n");
+            return;
+        default:
+            printf("at most %u FROM ports can have zones\r\n", MIDI2USBHUB_MAX_ZONED_INPUTS);
+            return;
+    }
+    printf("FROM         Zone Notes   TO\r\n");
+    for (auto in_port : hub.get_midi_in_port_list()) {
+        auto zones = hub.get_zones(in_port);
+        if (zones == nullptr)
+            continue;
+        for (uint8_t idx = 0; idx < Midi2usbhub::Input_zones::max_zones; idx++) {
+            auto& zone = zones->get_zone(idx);
+            if (!zone.in_use)
+                continue;
+            printf("%-12s %4u %3u-%-3u", in_port->nickname.c_str(), idx + 1, zone.lowest, zone.highest);
+            zone.sends_to.for_each([&](size_t port_idx) {
+                auto out_port = hub.get_midi_out_port(port_idx);
+                if (out_port != nullptr)
+                    printf(" %s", out_port->nickname.c_str());
+            });
+            printf("\r\n");
+        }
+    }
+}
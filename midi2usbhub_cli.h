@@ -72,6 +72,22 @@ private:
     static void static_show(EmbeddedCli *, char *, void *);
     static void static_reset(EmbeddedCli *, char *, void *);
     static void static_rename(EmbeddedCli *, char *, void *);
+    static void static_running_status(EmbeddedCli *, char *, void *);
+    static void static_pipeline(EmbeddedCli *, char *, void *);
+    static void static_idle(EmbeddedCli *, char *, void *);
+    static void static_latency(EmbeddedCli *, char *, void *);
+    static void static_stats(EmbeddedCli *, char *, void *);
+    static void static_merge(EmbeddedCli *, char *, void *);
+    static void static_queue(EmbeddedCli *, char *, void *);
+    static void static_flush(EmbeddedCli *, char *, void *);
+    static void static_inputs(EmbeddedCli *, char *, void *);
+    static void static_profile(EmbeddedCli *, char *, void *);
+    static void static_jitter(EmbeddedCli *, char *, void *);
+    static void static_delay(EmbeddedCli *, char *, void *);
+    static void static_thru(EmbeddedCli *, char *, void *);
+    static void static_filter(EmbeddedCli *, char *, void *);
+    static void static_transform(EmbeddedCli *, char *, void *);
+    static void static_zone(EmbeddedCli *, char *, void *);
     // data
     EmbeddedCli* cli;
 };
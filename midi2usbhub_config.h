@@ -0,0 +1,131 @@
+/**
+ * @file midi2usbhub_config.h
+ * @brief compile time configuration for the midi2usbhub application
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+
+// Set MIDI2USBHUB_DUAL_CORE to 1 to run the USB host stack, the CLI and
+// preset storage on core 0 and MIDI routing and the UART MIDI port on core 1.
+// Set it to 0 to run everything from one loop on core 0.
+#ifndef MIDI2USBHUB_DUAL_CORE
+#define MIDI2USBHUB_DUAL_CORE 1
+#endif
+
+// Set MIDI2USBHUB_IDLE_WFE to 1 to let each core sleep with WFE when it has
+// no work until an interrupt, the other core or a timer deadline wakes it.
+// Set it to 0 to poll continuously.
+#ifndef MIDI2USBHUB_IDLE_WFE
+#define MIDI2USBHUB_IDLE_WFE 1
+#endif
+
+// Number of USB MIDI event packets that can wait for the routing core.
+// Must be a power of 2.
+#define MIDI2USBHUB_USB_RX_QUEUE_SIZE 256
+
+// Number of USB MIDI event packets per USB device that can wait for the
+// USB host core to copy them to the device's OUT endpoint buffer.
+// Must be a power of 2.
+#define MIDI2USBHUB_USB_TX_QUEUE_SIZE 64
+
+// Default number of USB MIDI event packets each USB MIDI device may send to
+// the hub per pass of the main loop, so that a busy device cannot starve the
+// others. The serial port MIDI IN may send 3 bytes for each packet.
+#define MIDI2USBHUB_INPUT_BUDGET 16
+
+// Number of MIDI event packets that can wait, across all MIDI OUT ports,
+// for another MIDI IN port to finish sending a SysEx message to the same
+// MIDI OUT port. Must be less than 65535.
+#define MIDI2USBHUB_MERGE_HOLD_POOL_SIZE 128
+
+// Number of MIDI event packets that can wait, across all MIDI OUT ports,
+// in MIDI OUT port queues. Must be less than 65535.
+#define MIDI2USBHUB_OUT_QUEUE_POOL_SIZE 512
+
+// Number of MIDI event packets that can wait, across all routes, in the
+// route delay lines. Must be less than 65535.
+#define MIDI2USBHUB_DELAY_POOL_SIZE 2048
+
+// Longest delay in milliseconds a route may have
+#define MIDI2USBHUB_MAX_ROUTE_DELAY_MS 500
+
+// Default maximum number of MIDI event packets in one MIDI OUT port's queue
+#define MIDI2USBHUB_OUT_QUEUE_DEPTH 32
+
+// Default time in milliseconds a MIDI IN port that is sending a SysEx message
+// to a MIDI OUT port may go without sending more of it before the hub ends
+// the message and lets other MIDI IN ports send to the MIDI OUT port.
+#define MIDI2USBHUB_SYSEX_TIMEOUT_MS 500
+
+// Size in bytes of a USB device's bulk OUT transfer. In throughput mode the
+// hub starts a transfer as soon as this many bytes are waiting.
+#define MIDI2USBHUB_USB_FLUSH_BYTES 64
+
+// Default time in microseconds a USB MIDI OUT packet may wait for more
+// packets to share its bulk transfer in throughput mode
+#define MIDI2USBHUB_USB_FLUSH_DEADLINE_US 1000
+
+// Bytes per second the hub lets each USB MIDI OUT port send: one full 64-byte
+// bulk transfer per 1 ms USB frame, 3 MIDI bytes per 4-byte packet. The
+// serial port MIDI OUT is limited to its baud rate.
+#define MIDI2USBHUB_USB_WIRE_BYTES_PER_SECOND 48000
+
+// Number of bytes a MIDI OUT port may send back to back before its rate
+// limit applies
+#define MIDI2USBHUB_USB_WIRE_BURST_BYTES 192
+#define MIDI2USBHUB_UART_WIRE_BURST_BYTES 16
+
+// Longest fixed latency in microseconds a MIDI OUT port may have. Messages
+// wait in the MIDI OUT queues for up to this long.
+#define MIDI2USBHUB_MAX_FIXED_LATENCY_US 100000
+
+// Number of System Real-Time packets per USB device that can wait to be sent
+// ahead of the device's other queued packets. Must be a power of 2.
+#define MIDI2USBHUB_USB_RT_QUEUE_SIZE 16
+
+// Number of bytes the routing core keeps ready to send to the serial port
+// MIDI OUT. The MIDI OUT port's queue holds the rest. Must be a power of 2.
+#define MIDI2USBHUB_UART_TX_QUEUE_SIZE 16
+
+// The hub gives midi_uart_lib at most this many bytes at a time so that
+// System Real-Time bytes only wait for this many bytes in front of them.
+#define MIDI2USBHUB_UART_TX_LOOKAHEAD 3
+
+// Number of routes that can have a latency histogram at the same time.
+// Must be less than 256.
+#define MIDI2USBHUB_MAX_LATENCY_ROUTES 32
+
+// Number of routes that can have a transform at the same time. Each one
+// takes about 1.4 kbytes of RAM. Must be less than 256.
+#define MIDI2USBHUB_MAX_ROUTE_TRANSFORMS 16
+
+// Number of Note Offs for notes that were held when their route's transform
+// changed that can wait for the routing core to send them. Must be less
+// than 65535.
+#define MIDI2USBHUB_NOTE_OFF_POOL_SIZE 128
+
+// Number of MIDI IN ports that can be split into keyboard zones at the
+// same time. Each one takes about 2.3 kbytes of RAM. Must be less than 256.
+#define MIDI2USBHUB_MAX_ZONED_INPUTS 4
@@ -0,0 +1,77 @@
+/**
+ * @file midi_packet.h
+ * @brief helpers for working with 4-byte USB-MIDI 1.0 event packets
+ *
+ * Byte 0 of a packet holds the virtual cable number in the upper nibble
+ * and the Code Index Number (CIN) in the lower nibble. Bytes 1-3 hold
+ * the MIDI bytes of the message; the CIN says how many of them are used.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+namespace rppicomidi
+{
+namespace midi_packet
+{
+    inline uint8_t get_cable(const uint8_t packet[4]) { return packet[0] >> 4; }
+
+    inline uint8_t get_cin(const uint8_t packet[4]) { return packet[0] & 0xf; }
+
+    inline void set_cable(uint8_t packet[4], uint8_t cable) { packet[0] = static_cast<uint8_t>((cable << 4) | (packet[0] & 0xf)); }
+
+    inline bool is_realtime_byte(uint8_t byte) { return byte >= 0xF8; }
+
+    /**
+     * @brief return true if the packet carries a System Real-Time message
+     * (a single byte packet with a status byte 0xF8-0xFF)
+     */
+    inline bool is_realtime(const uint8_t packet[4]) { return get_cin(packet) == 0xF && is_realtime_byte(packet[1]); }
+
+    /**
+     * @brief return true if the packet carries all or part of a SysEx message
+     */
+    inline bool is_sysex(const uint8_t packet[4])
+    {
+        uint8_t cin = get_cin(packet);
+        return cin == 0x4 || cin == 0x6 || cin == 0x7 || (cin == 0x5 && packet[1] == 0xF7);
+    }
+
+    /**
+     * @brief return true if the packet is the last packet of a SysEx message
+     */
+    inline bool is_sysex_end(const uint8_t packet[4]) { return is_sysex(packet) && get_cin(packet) != 0x4; }
+
+    /**
+     * @brief get the number of MIDI bytes a packet with Code Index Number cin carries
+     *
+     * @return 0 for the reserved CIN values 0 and 1; 1-3 otherwise
+     */
+    inline uint8_t get_num_bytes(uint8_t cin)
+    {
+        static const uint8_t num_bytes[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+        return num_bytes[cin & 0xf];
+    }
+}
+}
@@ -0,0 +1,144 @@
+/**
+ * @file midi_stream_parser.cpp
+ * @brief convert a serial port MIDI byte stream to USB-MIDI 1.0 event packets
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "midi_stream_parser.h"
+
+bool rppicomidi::Midi_stream_parser::make_packet(uint8_t cin, uint8_t packet[4])
+{
+    packet[0] = cin;
+    packet[1] = bytes[0];
+    packet[2] = nbytes > 1 ? bytes[1] : 0;
+    packet[3] = nbytes > 2 ? bytes[2] : 0;
+    nbytes = 0;
+    return true;
+}
+
+bool rppicomidi::Midi_stream_parser::start_message(uint8_t status, uint8_t packet[4])
+{
+    nbytes = 0;
+    expected = 0;
+    if (status < 0xF0) {
+        // Channel Voice or Channel Mode
+        running_status = status;
+        bytes[nbytes++] = status;
+        expected = (status & 0xE0) == 0xC0 ? 2 : 3;
+        return false;
+    }
+    // System Common messages cancel running status
+    running_status = 0;
+    switch (status) {
+    case 0xF0:
+        in_sysex = true;
+        bytes[nbytes++] = status;
+        return false;
+    case 0xF1:
+    case 0xF3:
+        bytes[nbytes++] = status;
+        expected = 2;
+        return false;
+    case 0xF2:
+        bytes[nbytes++] = status;
+        expected = 3;
+        return false;
+    case 0xF6:
+        bytes[nbytes++] = status;
+        return make_packet(0x5, packet);
+    default:
+        // 0xF4, 0xF5 are undefined; 0xF7 without a SysEx message has nothing to end
+        return false;
+    }
+}
+
+bool rppicomidi::Midi_stream_parser::parse(uint8_t byte, uint8_t packet[4])
+{
+    if (byte >= 0xF8) {
+        // System Real-Time: may appear anywhere and does not interrupt the message in progress
+        if (byte == 0xF9 || byte == 0xFD)
+            return false; // undefined
+        packet[0] = 0xF;
+        packet[1] = byte;
+        packet[2] = 0;
+        packet[3] = 0;
+        return true;
+    }
+    if (in_sysex) {
+        if (byte == 0xF7) {
+            bytes[nbytes++] = byte;
+            in_sysex = false;
+            // SysEx ends with the following 1, 2 or 3 bytes
+            return make_packet(static_cast<uint8_t>(0x4 + nbytes), packet);
+        }
+        if (byte < 0x80) {
+            bytes[nbytes++] = byte;
+            if (nbytes == 3)
+                return make_packet(0x4, packet); // SysEx starts or continues
+            return false;
+        }
+        // Any other status byte ends the SysEx message early. Close it so
+        // the receiver is not left waiting for the end of the message, then
+        // start the new message. A Tune Request is a whole message by
+        // itself, so it waits for get_pending().
+        in_sysex = false;
+        bytes[nbytes++] = 0xF7;
+        make_packet(static_cast<uint8_t>(0x4 + nbytes), packet);
+        uint8_t tune_request[4];
+        tune_request_pending = start_message(byte, tune_request);
+        return true;
+    }
+    if (byte >= 0x80)
+        return start_message(byte, packet);
+    // data byte
+    if (expected == 0) {
+        if (running_status == 0)
+            return false; // no status byte to go with it
+        bytes[nbytes++] = running_status;
+        expected = (running_status & 0xE0) == 0xC0 ? 2 : 3;
+    }
+    bytes[nbytes++] = byte;
+    if (nbytes < expected)
+        return false;
+    expected = 0;
+    uint8_t status = bytes[0];
+    uint8_t cin;
+    if (status < 0xF0)
+        cin = status >> 4;
+    else
+        cin = nbytes == 2 ? 0x2 : 0x3; // two or three byte System Common message
+    return make_packet(cin, packet);
+}
+
+bool rppicomidi::Midi_stream_parser::get_pending(uint8_t packet[4])
+{
+    if (!tune_request_pending)
+        return false;
+    tune_request_pending = false;
+    packet[0] = 0x5; // single byte System Common message
+    packet[1] = 0xF6;
+    packet[2] = 0;
+    packet[3] = 0;
+    return true;
+}
@@ -0,0 +1,82 @@
+/**
+ * @file midi_stream_parser.h
+ * @brief convert a serial port MIDI byte stream to USB-MIDI 1.0 event packets
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+namespace rppicomidi
+{
+/**
+ * @brief assemble the bytes of a MIDI 1.0 byte stream into complete
+ * messages, one USB-MIDI event packet per message
+ *
+ * The parser keeps its state between calls, so messages may be split
+ * across any number of reads from the UART, and it supplies the running
+ * status byte for messages sent without one. SysEx messages become a
+ * sequence of packets: CIN 0x4 for each 3 bytes of the message and CIN
+ * 0x5-0x7 for the last 1-3 bytes. System Real-Time bytes become their own
+ * packets right away without disturbing the message they interrupt.
+ */
+class Midi_stream_parser
+{
+public:
+    Midi_stream_parser() { reset(); }
+
+    /**
+     * @brief forget any partial message and the running status
+     */
+    void reset() { running_status = 0; nbytes = 0; expected = 0; in_sysex = false; tune_request_pending = false; }
+
+    /**
+     * @brief add the next byte of the stream to the message in progress
+     *
+     * @param byte the next byte received
+     * @param packet the 4-byte USB-MIDI event packet with cable number 0
+     * if the byte completes a packet. Not changed otherwise.
+     * @return true if packet holds a new packet
+     */
+    bool parse(uint8_t byte, uint8_t packet[4]);
+
+    /**
+     * @brief get the second packet of the last byte parse() read, if it
+     * made two. Only a Tune Request that ends an unterminated SysEx
+     * message makes two packets: the end of the SysEx message and the
+     * Tune Request.
+     *
+     * @return true if packet holds the second packet
+     */
+    bool get_pending(uint8_t packet[4]);
+private:
+    bool make_packet(uint8_t cin, uint8_t packet[4]);
+    bool start_message(uint8_t status, uint8_t packet[4]);
+    uint8_t running_status;  // the Channel Voice status byte for messages without one; 0 if none
+    uint8_t bytes[3];        // the bytes of the message or SysEx packet in progress
+    uint8_t nbytes;          // the number of bytes in bytes[]
+    uint8_t expected;        // the number of bytes in the message in progress; 0 if none
+    bool in_sysex;
+    bool tune_request_pending; // a Tune Request ended a SysEx message; get_pending() returns it
+};
+}
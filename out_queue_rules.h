@@ -0,0 +1,157 @@
+/**
+ * @file out_queue_rules.h
+ * @brief the rules a MIDI OUT port queue uses to release its oldest packet
+ * and to thin stale controller values
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+#include "midi_packet.h"
+#include "packet_pool.h"
+#include "token_bucket.h"
+namespace rppicomidi
+{
+namespace out_queue_rules
+{
+    // What a MIDI OUT queue does with its oldest packet
+    enum class Release : uint8_t
+    {
+        send,       // send it now
+        hold,       // wait for its fixed latency release time
+        throttle,   // wait for the port's rate limit
+    };
+
+    /**
+     * @brief decide what a MIDI OUT queue does with its oldest packet
+     *
+     * @param timestamp the time_us_32() time the hub received the packet
+     * @param fixed_latency_us the port's fixed latency; 0 if it has none
+     * @param shaper the port's rate limit
+     * @param now the time_us_32() time
+     * @param wait_us set to how long until the packet may go if the result
+     * is not Release::send
+     */
+    inline Release get_release(uint32_t timestamp, uint32_t fixed_latency_us, Token_bucket& shaper, uint32_t now, uint32_t& wait_us)
+    {
+        if (fixed_latency_us != 0)
+        {
+            uint32_t age = now - timestamp;
+            if (age < fixed_latency_us)
+            {
+                wait_us = fixed_latency_us - age;
+                return Release::hold;
+            }
+        }
+        if (!shaper.conforms(now))
+        {
+            wait_us = shaper.get_wait_us(now);
+            return Release::throttle;
+        }
+        return Release::send;
+    }
+
+    /**
+     * @brief get a key that two packets share if the later one makes the
+     * earlier one stale
+     *
+     * @return the key, or 0 if the packet must never be thinned
+     */
+    inline uint16_t get_thinning_key(const uint8_t packet[4])
+    {
+        uint8_t cin = midi_packet::get_cin(packet);
+        uint8_t status = packet[1];
+        if ((status >> 4) != cin)
+            return 0; // not a channel voice message
+        switch (cin)
+        {
+        case 0xA: // Polyphonic Key Pressure
+            return (status << 8) | packet[2];
+        case 0xB: // Control Change
+            switch (packet[2])
+            {
+            case 0: case 32:   // Bank Select applies to the next Program Change
+            case 6: case 38:   // Data Entry
+            case 96: case 97:  // Data Increment and Decrement
+            case 98: case 99:  // NRPN
+            case 100: case 101:// RPN
+                return 0;
+            default:
+                // Channel Mode messages
+                return packet[2] >= 120 ? 0 : (status << 8) | packet[2];
+            }
+        case 0xD: // Channel Pressure
+        case 0xE: // Pitch Bend
+            return status << 8;
+        default:
+            return 0;
+        }
+    }
+
+    /**
+     * @brief remove the packets in list that packet makes stale: earlier
+     * values of the same controller, pitch bend, channel pressure or
+     * polyphonic key pressure on the same channel. 14-bit controllers are
+     * removed only as complete MSB/LSB pairs. Bank Select, RPN, NRPN, Data
+     * Entry, channel mode messages, notes and SysEx are never removed.
+     *
+     * @param pool the pool of list; its items have a packet[4] member
+     * @return the number of packets removed
+     */
+    template<typename Pool>
+    uint16_t thin_packets(Pool& pool, Packet_list& list, const uint8_t packet[4])
+    {
+        uint16_t key = get_thinning_key(packet);
+        if (key == 0)
+            return 0;
+        uint8_t controller = packet[2];
+        if (midi_packet::get_cin(packet) == 0xB && controller < 64)
+        {
+            // Controllers 0-31 are the MSBs and 32-63 the LSBs of 14-bit controllers
+            uint16_t msb_key = key & ~32;
+            uint16_t lsb_key = key | 32;
+            bool pair_queued = false;
+            pool.for_each(list, [&](const auto& queued) {
+                if (get_thinning_key(queued.packet) == (key ^ 32))
+                    pair_queued = true;
+            });
+            if (pair_queued)
+            {
+                // Remove earlier pairs only when the new pair is complete: the
+                // new packet is the LSB and the last queued packet is its MSB
+                auto msb = pool.back(list);
+                if (key != lsb_key || get_thinning_key(msb->packet) != msb_key)
+                    return 0;
+                return pool.remove_if(list, [&](const auto& queued) {
+                    uint16_t queued_key = get_thinning_key(queued.packet);
+                    return &queued != msb && (queued_key == msb_key || queued_key == lsb_key);
+                });
+            }
+        }
+        return pool.remove_if(list, [&](const auto& queued) {
+            return get_thinning_key(queued.packet) == key;
+        });
+    }
+}
+}
@@ -0,0 +1,212 @@
+/**
+ * @file packet_pool.h
+ * @brief a fixed size pool of list nodes for queues that share storage
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+namespace rppicomidi
+{
+/**
+ * @brief a FIFO list of nodes in a Packet_pool
+ */
+struct Packet_list
+{
+    static const uint16_t none = 0xFFFF;
+    uint16_t head = none;
+    uint16_t tail = none;
+    uint16_t count = 0;
+    bool empty() const { return head == none; }
+};
+
+/**
+ * @brief a pool of capacity nodes of type T that any number of FIFO lists
+ * share without using the heap
+ *
+ * Each list knows its own length, so a caller can give each list its own
+ * limit while all lists draw from the same storage. The pool does no
+ * locking; only one core may use a pool and its lists at a time.
+ */
+template<typename T, uint16_t capacity>
+class Packet_pool
+{
+public:
+    static const uint16_t none = Packet_list::none;
+    static_assert(capacity < none, "Packet_pool capacity must be less than 65535");
+    typedef Packet_list List;
+
+    Packet_pool() { clear(); }
+
+    /**
+     * @brief return every node to the pool. Any existing lists become invalid.
+     */
+    void clear()
+    {
+        for (uint16_t idx = 0; idx < capacity; idx++)
+            nodes[idx].next = idx + 1 < capacity ? idx + 1 : none;
+        free_head = 0;
+        num_used = 0;
+        high_water = 0;
+    }
+
+    uint16_t get_num_free() const { return capacity - num_used; }
+    uint16_t get_high_water() const { return high_water; }
+    void reset_high_water() { high_water = num_used; }
+    static uint16_t get_capacity() { return capacity; }
+
+    /**
+     * @brief add a copy of item to the end of list
+     *
+     * @return true if successful, false if the pool has no free nodes
+     */
+    bool push_back(List& list, const T& item)
+    {
+        if (free_head == none)
+            return false;
+        uint16_t idx = free_head;
+        free_head = nodes[idx].next;
+        nodes[idx].item = item;
+        nodes[idx].next = none;
+        if (list.tail == none)
+            list.head = idx;
+        else
+            nodes[list.tail].next = idx;
+        list.tail = idx;
+        ++list.count;
+        if (++num_used > high_water)
+            high_water = num_used;
+        return true;
+    }
+
+    T* front(List& list) { return list.empty() ? nullptr : &nodes[list.head].item; }
+
+    T* back(List& list) { return list.empty() ? nullptr : &nodes[list.tail].item; }
+
+    /**
+     * @brief remove the first item from list and return it to the pool.
+     * The list must not be empty.
+     */
+    void pop_front(List& list)
+    {
+        uint16_t idx = list.head;
+        list.head = nodes[idx].next;
+        if (list.head == none)
+            list.tail = none;
+        --list.count;
+        release(idx);
+    }
+
+    /**
+     * @brief call fn(item) for every item in list, first to last
+     */
+    template<typename Fn>
+    void for_each(List& list, Fn fn)
+    {
+        for (uint16_t idx = list.head; idx != none; idx = nodes[idx].next)
+            fn(nodes[idx].item);
+    }
+
+    /**
+     * @brief remove the first item in list for which fn(item) returns true
+     *
+     * @return true if an item was removed
+     */
+    template<typename Fn>
+    bool remove_first_if(List& list, Fn fn)
+    {
+        return remove(list, fn, true) != 0;
+    }
+
+    /**
+     * @brief remove every item in list for which fn(item) returns true
+     *
+     * @return the number of items removed
+     */
+    template<typename Fn>
+    uint16_t remove_if(List& list, Fn fn)
+    {
+        return remove(list, fn, false);
+    }
+
+    /**
+     * @brief return every node of list to the pool
+     */
+    void clear(List& list)
+    {
+        while (!list.empty())
+            pop_front(list);
+    }
+private:
+    struct Node
+    {
+        T item;
+        uint16_t next;
+    };
+
+    void release(uint16_t idx)
+    {
+        nodes[idx].next = free_head;
+        free_head = idx;
+        --num_used;
+    }
+
+    template<typename Fn>
+    uint16_t remove(List& list, Fn fn, bool first_only)
+    {
+        uint16_t nremoved = 0;
+        uint16_t prev = none;
+        uint16_t idx = list.head;
+        while (idx != none)
+        {
+            uint16_t next = nodes[idx].next;
+            if (fn(nodes[idx].item))
+            {
+                if (prev == none)
+                    list.head = next;
+                else
+                    nodes[prev].next = next;
+                if (list.tail == idx)
+                    list.tail = prev;
+                --list.count;
+                release(idx);
+                ++nremoved;
+                if (first_only)
+                    break;
+            }
+            else
+            {
+                prev = idx;
+            }
+            idx = next;
+        }
+        return nremoved;
+    }
+
+    Node nodes[capacity];
+    uint16_t free_head;
+    uint16_t num_used;
+    uint16_t high_water;
+};
+}
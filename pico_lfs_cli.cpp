@@ -24,6 +24,7 @@
  */
 #include "pico_lfs_cli.h"
 #include "pico_hal.h"
+#include "routing_core_lockout.h"
 rppicomidi::Pico_lfs_cli::Pico_lfs_cli(EmbeddedCli* cli_) : cli{cli_}
 {
     bool result = embeddedCliAddBinding(cli, {
@@ -116,6 +117,7 @@ int rppicomidi::Pico_lfs_cli::lfs_ls(const char *path)
 void rppicomidi::Pico_lfs_cli::static_file_system_format(EmbeddedCli*, char*, void*)
 {
     printf("formatting settings file system then mounting it\r\n");
+    Routing_core_lockout lockout;
     int error_code = pico_mount(true);
     if (error_code != LFS_ERR_OK) {
 
@@ -199,6 +201,7 @@ void rppicomidi::Pico_lfs_cli::static_delete_file(EmbeddedCli* cli, char* args,
 
 int rppicomidi::Pico_lfs_cli::delete_file(const char* filename, bool mount)
 {
+    Routing_core_lockout lockout;
     int error_code = LFS_ERR_OK;
     if (mount)
         error_code = pico_mount(false);
@@ -0,0 +1,90 @@
+/**
+ * @file port_mask.h
+ * @brief a fixed size bit set of MIDI port indices that can quickly
+ * visit every port whose bit is set
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+namespace rppicomidi
+{
+template<size_t num_ports>
+class Port_mask
+{
+public:
+    Port_mask() { clear(); }
+
+    void clear()
+    {
+        for (auto& word : words)
+            word = 0;
+    }
+
+    void set(size_t idx) { words[idx / 32] |= (1ul << (idx % 32)); }
+
+    void reset(size_t idx) { words[idx / 32] &= ~(1ul << (idx % 32)); }
+
+    bool test(size_t idx) const { return (words[idx / 32] & (1ul << (idx % 32))) != 0; }
+
+    bool operator==(const Port_mask& other) const
+    {
+        for (size_t word_idx = 0; word_idx < num_words; word_idx++) {
+            if (words[word_idx] != other.words[word_idx])
+                return false;
+        }
+        return true;
+    }
+
+    bool any() const
+    {
+        for (auto word : words) {
+            if (word != 0)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief call fn(idx) for every port index idx whose bit is set,
+     * lowest index first. Only the set bits are visited.
+     */
+    template<typename Fn>
+    void for_each(Fn fn) const
+    {
+        for (size_t word_idx = 0; word_idx < num_words; word_idx++) {
+            uint32_t bits = words[word_idx];
+            while (bits != 0) {
+                size_t bit = __builtin_ctz(bits);
+                bits &= bits - 1; // clear the lowest set bit
+                fn(word_idx * 32 + bit);
+            }
+        }
+    }
+private:
+    static constexpr size_t num_words = (num_ports + 31) / 32;
+    uint32_t words[num_words];
+};
+}
@@ -30,6 +30,7 @@
 #include "midi2usbhub.h"
 #include "diskio.h"
 #include "rp2040_rtc.h"
+#include "routing_core_lockout.h"
 rppicomidi::Preset_manager::Preset_manager()
 {
     // Make sure the flash filesystem is working
@@ -68,6 +69,7 @@ rppicomidi::Preset_manager::Preset_manager()
 
 bool rppicomidi::Preset_manager::save_current_preset(std::string preset_name)
 {
+    Routing_core_lockout lockout;
     // mount the lfs
     int error_code = pico_mount(false);
     if (error_code != 0) {
@@ -102,12 +104,58 @@ bool rppicomidi::Preset_manager::save_current_preset(std::string preset_name)
     return result;
 }
 
+bool rppicomidi::Preset_manager::save_device_profiles(const std::string& serialized_profiles)
+{
+    Routing_core_lockout lockout;
+    int error_code = pico_mount(false);
+    if (error_code != 0) {
+        printf("Error %s mounting the flash file system\r\n", pico_errmsg(error_code));
+        return false;
+    }
+    lfs_file_t file;
+    error_code = lfs_file_open(&file, device_profiles_filename,
+                                LFS_O_WRONLY | LFS_O_TRUNC | LFS_O_CREAT); // open for write, truncate if it exists and create if it doesn't
+    if (error_code != LFS_ERR_OK) {
+        pico_unmount();
+        printf("error %s opening file %s\r\n", pico_errmsg(error_code), device_profiles_filename);
+        return false;
+    }
+    lfs_ssize_t size = lfs_file_write(&file, serialized_profiles.c_str(), serialized_profiles.length());
+    error_code = lfs_file_close(&file);
+    pico_unmount();
+    if (size < 0 || size != static_cast<lfs_ssize_t>(serialized_profiles.length())) {
+        printf("error %s writing device profiles to file %s\r\n", pico_errmsg(size), device_profiles_filename);
+        return false;
+    }
+    if (error_code != LFS_ERR_OK) {
+        printf("error %s closing file %s\r\n", pico_errmsg(error_code), device_profiles_filename);
+        return false;
+    }
+    return true;
+}
+
+bool rppicomidi::Preset_manager::load_device_profiles(std::string& serialized_profiles)
+{
+    char* raw_profiles_string;
+    int error_code = load_settings_string(device_profiles_filename, &raw_profiles_string);
+    if (error_code > 0) {
+        serialized_profiles = std::string(raw_profiles_string);
+        delete[] raw_profiles_string;
+        return true;
+    }
+    // No profiles have been saved yet
+    if (error_code < 0 && error_code != LFS_ERR_NOENT)
+        printf("error %s loading device profiles\r\n", pico_errmsg(error_code));
+    return false;
+}
+
 bool rppicomidi::Preset_manager::update_current_preset(std::string& preset_name, bool mount)
 {
     bool result = true;
 
     // only need to do stuff if the preset_name is not the current_preset_name
     if (preset_name != current_preset_name) {
+        Routing_core_lockout lockout;
         if (mount) {
             int err = pico_mount(false);
             if (err != 0) {
@@ -352,6 +400,7 @@ FRESULT rppicomidi::Preset_manager::restore_preset(const char* preset_name)
         return res;
     }
     f_close(&fil);
+    Routing_core_lockout lockout;
     int error_code = pico_mount(false);
     if (error_code != 0) {
         printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
@@ -90,6 +90,22 @@ public:
      * @return FRESULT FR_ERR_OK if successful, a FatFs error code if not
      */
     FRESULT restore_preset(const char* preset_name);
+
+    /**
+     * @brief Save the USB device profiles to the LFS file device_profiles_filename
+     *
+     * @param serialized_profiles the profiles in JSON format
+     * @return true if successful, false otherwise
+     */
+    bool save_device_profiles(const std::string& serialized_profiles);
+
+    /**
+     * @brief Load the USB device profiles from the LFS file device_profiles_filename
+     *
+     * @param serialized_profiles is set to the profiles in JSON format
+     * @return true if successful, false if the file does not exist or could not be read
+     */
+    bool load_device_profiles(std::string& serialized_profiles);
 private:
     /**
      * @brief set raw_settings_ptr to point to the data contained in the settings
@@ -112,5 +128,6 @@ private:
     std::string current_preset_name;
     static constexpr const char* preset_dir_name = "/rppicomidi-midi2usbhub";
     static constexpr const char* current_preset_filename = "current-preset";
+    static constexpr const char* device_profiles_filename = "device-profiles";
 };
 }
\ No newline at end of file
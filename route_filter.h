@@ -0,0 +1,151 @@
+/**
+ * @file route_filter.h
+ * @brief a filter that decides which MIDI messages pass along a route
+ * with a MIDI channel mask and a message class mask
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+#include <cstring>
+namespace rppicomidi
+{
+/**
+ * @brief decide which USB-MIDI event packets a route passes
+ *
+ * The filter is two 16-bit masks: one bit per MIDI channel for Channel
+ * Voice messages and one bit per Message_class for every message. The
+ * decision for a packet is a table lookup of the class of its first MIDI
+ * byte and one or two mask tests. Every packet of a SysEx message has the
+ * sysex class, so a filter never passes only part of a SysEx message.
+ */
+class Route_filter
+{
+public:
+    enum Message_class : uint8_t
+    {
+        note_off,
+        note_on,
+        poly_pressure,
+        control_change,
+        program_change,
+        channel_pressure,
+        pitch_bend,
+        sysex,
+        time_code,
+        song_position,
+        song_select,
+        tune_request,   // also the undefined System Common status bytes 0xF4 and 0xF5
+        clock,          // also the undefined System Real-Time status byte 0xF9
+        transport,      // Start, Continue and Stop
+        active_sensing, // also the undefined System Real-Time status byte 0xFD
+        system_reset,
+        num_classes
+    };
+
+    static const uint16_t pass_all = 0xFFFF;
+
+    Route_filter() : channels{pass_all}, classes{pass_all} {}
+
+    bool passes_all() const { return channels == pass_all && classes == pass_all; }
+    uint16_t get_channels() const { return channels; }
+    uint16_t get_classes() const { return classes; }
+    void set_masks(uint16_t channels_, uint16_t classes_) { channels = channels_; classes = classes_; }
+    void set_all(bool pass) { channels = pass ? pass_all : 0; classes = pass ? pass_all : 0; }
+
+    /**
+     * @brief pass or block Channel Voice messages on MIDI channel 1-16
+     */
+    void set_channel(uint8_t channel, bool pass) { set_bit(channels, channel - 1, pass); }
+    void set_class(Message_class cls, bool pass) { set_bit(classes, cls, pass); }
+
+    /**
+     * @brief return true if the route should send packet
+     */
+    bool passes(const uint8_t packet[4]) const
+    {
+        uint8_t status = packet[1];
+        if ((classes & (1u << get_message_class(status))) == 0)
+            return false;
+        return status < 0x80 || status >= 0xF0 || (channels & (1u << (status & 0xF))) != 0;
+    }
+
+    /**
+     * @brief get the class of the message that starts with byte. A data
+     * byte can only start the packet of a SysEx message.
+     */
+    static Message_class get_message_class(uint8_t byte)
+    {
+        static const Message_class system_class[16] = {
+            sysex, time_code, song_position, song_select, tune_request, tune_request, tune_request, sysex,
+            clock, clock, transport, transport, transport, active_sensing, active_sensing, system_reset
+        };
+        if (byte < 0x80)
+            return sysex;
+        if (byte < 0xF0)
+            return static_cast<Message_class>((byte >> 4) - 8);
+        return system_class[byte & 0xF];
+    }
+
+    /**
+     * @brief get the name the CLI and the presets use for a message class
+     */
+    static const char* get_class_name(Message_class cls)
+    {
+        static const char* names[num_classes] = {
+            "noteoff", "noteon", "polypressure", "cc", "program", "pressure", "pitchbend", "sysex",
+            "mtc", "songpos", "songsel", "tune", "clock", "transport", "sensing", "reset"
+        };
+        return cls < num_classes ? names[cls] : "";
+    }
+
+    /**
+     * @brief find the message class with the given name
+     *
+     * @return true if found; false if name is not a message class name
+     */
+    static bool find_class(const char* name, Message_class& cls)
+    {
+        for (uint8_t idx = 0; idx < num_classes; idx++)
+        {
+            if (strcmp(name, get_class_name(static_cast<Message_class>(idx))) == 0)
+            {
+                cls = static_cast<Message_class>(idx);
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    static void set_bit(uint16_t& mask, uint8_t bit, bool value)
+    {
+        if (value)
+            mask |= static_cast<uint16_t>(1u << bit);
+        else
+            mask &= static_cast<uint16_t>(~(1u << bit));
+    }
+    uint16_t channels;  // bit n set passes Channel Voice messages on MIDI channel n+1
+    uint16_t classes;   // bit n set passes messages of Message_class n
+};
+}
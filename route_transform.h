@@ -0,0 +1,298 @@
+/**
+ * @file route_transform.h
+ * @brief an ordered chain of MIDI message transforms for one route, each
+ * compiled to a lookup table
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+namespace rppicomidi
+{
+/**
+ * @brief change the Channel Voice messages a route sends
+ *
+ * A transform is an ordered chain of up to max_stages stages. Adding a
+ * stage compiles its settings to a lookup table, so applying a stage to a
+ * packet is one table load. Stages only change Channel Voice messages;
+ * every other message passes through unchanged.
+ *
+ * A transform does not remember which notes it has turned on. The hub
+ * keeps a Held_notes for each route transform and turns the held notes
+ * off through the old chain before it changes or removes one.
+ */
+class Route_transform
+{
+public:
+    enum Stage_type : uint8_t
+    {
+        channel_map,    // params: from channel 1-16 or 0 for all, to channel 1-16
+        transpose,      // params: semitones, lowest note, highest note
+        cc_map,         // params: from controller number, to controller number
+        velocity_curve, // params: Velocity_mode, then the mode's settings
+        num_stage_types
+    };
+
+    enum Velocity_mode : uint8_t
+    {
+        fixed,  // params: velocity 1-127
+        range,  // params: minimum velocity, maximum velocity; both 1-127
+        curve,  // params: exponent in percent 10-1000; under 100 is louder
+        num_velocity_modes
+    };
+
+    static const uint8_t max_stages = 8;
+    static const uint8_t drop = 0xFF; // a transpose table entry for notes it drops
+
+    struct Stage
+    {
+        Stage_type type;
+        int16_t params[3];
+        uint8_t table[128]; // only the first 16 entries are used by a channel_map
+    };
+
+    Route_transform() : num_stages{0} {}
+
+    bool empty() const { return num_stages == 0; }
+    void clear() { num_stages = 0; }
+    uint8_t get_num_stages() const { return num_stages; }
+    const Stage& get_stage(uint8_t idx) const { return stages[idx]; }
+
+    /**
+     * @brief return true if both chains have the same stages with the same params
+     */
+    bool operator==(const Route_transform& other) const
+    {
+        if (num_stages != other.num_stages)
+            return false;
+        for (uint8_t idx = 0; idx < num_stages; idx++) {
+            const Stage& stage = stages[idx];
+            const Stage& other_stage = other.stages[idx];
+            if (stage.type != other_stage.type || stage.params[0] != other_stage.params[0] ||
+                    stage.params[1] != other_stage.params[1] || stage.params[2] != other_stage.params[2])
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief compile a stage and add it to the end of the chain
+     *
+     * @return true if successful; false if the chain is full or the
+     * params are out of range for the stage type
+     */
+    bool add_stage(Stage_type type, int16_t param0, int16_t param1 = 0, int16_t param2 = 0)
+    {
+        if (num_stages >= max_stages)
+            return false;
+        Stage& stage = stages[num_stages];
+        stage.type = type;
+        stage.params[0] = param0;
+        stage.params[1] = param1;
+        stage.params[2] = param2;
+        if (!compile(stage))
+            return false;
+        ++num_stages;
+        return true;
+    }
+
+    /**
+     * @brief remove the stage at index idx; later stages move up one
+     *
+     * @return false if there is no stage idx
+     */
+    bool remove_stage(uint8_t idx)
+    {
+        if (idx >= num_stages)
+            return false;
+        --num_stages;
+        for (; idx < num_stages; idx++)
+            stages[idx] = stages[idx + 1];
+        return true;
+    }
+
+    /**
+     * @brief run packet through the chain in order
+     *
+     * @return false if a stage dropped the packet
+     */
+    bool apply(uint8_t packet[4]) const
+    {
+        uint8_t status = packet[1];
+        if (status < 0x80 || status >= 0xF0)
+            return true;
+        const uint8_t kind = status & 0xF0; // a channel map never changes the kind
+        for (uint8_t idx = 0; idx < num_stages; idx++) {
+            const Stage& stage = stages[idx];
+            switch (stage.type) {
+            case channel_map:
+                packet[1] = kind | stage.table[packet[1] & 0xF];
+                break;
+            case transpose:
+                // Note Off, Note On and Polyphonic Key Pressure
+                if (kind <= 0xA0) {
+                    uint8_t note = stage.table[packet[2] & 0x7F];
+                    if (note == drop)
+                        return false;
+                    packet[2] = note;
+                }
+                break;
+            case cc_map:
+                if (kind == 0xB0)
+                    packet[2] = stage.table[packet[2] & 0x7F];
+                break;
+            case velocity_curve:
+                // velocity 0 means Note Off and stays 0
+                if (kind == 0x90 && packet[3] != 0)
+                    packet[3] = stage.table[packet[3] & 0x7F];
+                break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief get the name the CLI and the presets use for a stage type
+     */
+    static const char* get_stage_type_name(Stage_type type)
+    {
+        static const char* names[num_stage_types] = {"channel", "transpose", "cc", "velocity"};
+        return type < num_stage_types ? names[type] : "";
+    }
+
+    /**
+     * @brief find the stage type with the given name
+     *
+     * @return true if found; false if name is not a stage type name
+     */
+    static bool find_stage_type(const char* name, Stage_type& type)
+    {
+        for (uint8_t idx = 0; idx < num_stage_types; idx++)
+        {
+            if (strcmp(name, get_stage_type_name(static_cast<Stage_type>(idx))) == 0)
+            {
+                type = static_cast<Stage_type>(idx);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static const char* get_velocity_mode_name(Velocity_mode mode)
+    {
+        static const char* names[num_velocity_modes] = {"fixed", "range", "curve"};
+        return mode < num_velocity_modes ? names[mode] : "";
+    }
+
+    static bool find_velocity_mode(const char* name, Velocity_mode& mode)
+    {
+        for (uint8_t idx = 0; idx < num_velocity_modes; idx++)
+        {
+            if (strcmp(name, get_velocity_mode_name(static_cast<Velocity_mode>(idx))) == 0)
+            {
+                mode = static_cast<Velocity_mode>(idx);
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    static bool is_data_byte(int16_t value) { return value >= 0 && value <= 127; }
+    static bool is_velocity(int16_t value) { return value >= 1 && value <= 127; }
+
+    /**
+     * @brief fill in stage.table from stage.type and stage.params
+     *
+     * @return false if the params are out of range
+     */
+    static bool compile(Stage& stage)
+    {
+        const int16_t* params = stage.params;
+        for (uint8_t idx = 0; idx < 128; idx++)
+            stage.table[idx] = idx;
+        switch (stage.type) {
+        case channel_map:
+            if (params[0] < 0 || params[0] > 16 || params[1] < 1 || params[1] > 16)
+                return false;
+            for (uint8_t channel = 0; channel < 16; channel++) {
+                if (params[0] == 0 || params[0] == channel + 1)
+                    stage.table[channel] = static_cast<uint8_t>(params[1] - 1);
+            }
+            return true;
+        case transpose:
+            if (params[0] < -127 || params[0] > 127 || !is_data_byte(params[1]) || !is_data_byte(params[2]) ||
+                    params[1] > params[2])
+                return false;
+            for (int16_t note = params[1]; note <= params[2]; note++) {
+                int16_t result = note + params[0];
+                stage.table[note] = is_data_byte(result) ? static_cast<uint8_t>(result) : drop;
+            }
+            return true;
+        case cc_map:
+            if (!is_data_byte(params[0]) || !is_data_byte(params[1]))
+                return false;
+            stage.table[params[0]] = static_cast<uint8_t>(params[1]);
+            return true;
+        case velocity_curve:
+            switch (params[0]) {
+            case fixed:
+                if (!is_velocity(params[1]))
+                    return false;
+                for (uint8_t velocity = 1; velocity < 128; velocity++)
+                    stage.table[velocity] = static_cast<uint8_t>(params[1]);
+                return true;
+            case range:
+                if (!is_velocity(params[1]) || !is_velocity(params[2]))
+                    return false;
+                for (uint8_t velocity = 1; velocity < 128; velocity++) {
+                    // map 1-127 onto params[1]-params[2], rounded to nearest
+                    int32_t scaled = (velocity - 1) * (params[2] - params[1]);
+                    scaled = (scaled + (scaled < 0 ? -63 : 63)) / 126;
+                    stage.table[velocity] = static_cast<uint8_t>(params[1] + scaled);
+                }
+                return true;
+            case curve:
+                if (params[1] < 10 || params[1] > 1000)
+                    return false;
+                for (uint8_t velocity = 1; velocity < 128; velocity++) {
+                    float result = 127.0f * powf(velocity / 127.0f, params[1] / 100.0f) + 0.5f;
+                    stage.table[velocity] = result < 1.0f ? 1 : static_cast<uint8_t>(result);
+                }
+                return true;
+            default:
+                return false;
+            }
+        default:
+            return false;
+        }
+    }
+
+    uint8_t num_stages;
+    Stage stages[max_stages];
+};
+}
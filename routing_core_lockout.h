@@ -0,0 +1,70 @@
+/**
+ * @file routing_core_lockout.h
+ * @brief pause the routing core while the USB host core writes flash
+ *
+ * Core 1 runs its MIDI routing code from program flash. It has to stop while
+ * core 0 programs or erases flash, so wrap every LittleFs operation that can
+ * write flash in a Routing_core_lockout object. The lockout nests, so it is
+ * safe to create one in a function called by a function that holds one.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include "midi2usbhub_config.h"
+#if MIDI2USBHUB_DUAL_CORE
+#include "pico/multicore.h"
+#endif
+namespace rppicomidi
+{
+class Routing_core_lockout
+{
+public:
+    Routing_core_lockout() : locked{false}
+    {
+#if MIDI2USBHUB_DUAL_CORE
+        if (routing_core_running) {
+            locked = true;
+            if (depth++ == 0)
+                multicore_lockout_start_blocking();
+        }
+#endif
+    }
+    Routing_core_lockout(Routing_core_lockout const&) = delete;
+    void operator=(Routing_core_lockout const&) = delete;
+
+    ~Routing_core_lockout()
+    {
+#if MIDI2USBHUB_DUAL_CORE
+        if (locked && --depth == 0)
+            multicore_lockout_end_blocking();
+#endif
+    }
+
+    // set once the routing core has called multicore_lockout_victim_init()
+    static inline volatile bool routing_core_running = false;
+private:
+    static inline int depth = 0;
+    bool locked;
+};
+}
@@ -0,0 +1,108 @@
+/**
+ * @file running_status_encoder.cpp
+ * @brief implementation of the Running_status_encoder class
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "running_status_encoder.h"
+
+rppicomidi::Running_status_encoder::Running_status_encoder() :
+    enabled{true}, note_off_as_note_on{false}, running_status{0}, current_status{0},
+    data_byte_count{0}, convert_note_off{false}, in_sysex{false}
+{
+    reset_stats();
+}
+
+size_t rppicomidi::Running_status_encoder::encode(const uint8_t* src, size_t nbytes, uint8_t* dest)
+{
+    size_t nout = 0;
+    for (size_t idx = 0; idx < nbytes; idx++) {
+        uint8_t byte = src[idx];
+        if (byte >= 0xF8) {
+            // System Real-Time: may appear anywhere and does not affect running status
+            dest[nout++] = byte;
+        }
+        else if (byte >= 0xF0) {
+            // SysEx or System Common: cancels running status
+            dest[nout++] = byte;
+            running_status = 0;
+            current_status = 0;
+            convert_note_off = false;
+            in_sysex = (byte == 0xF0);
+        }
+        else if (byte >= 0x80) {
+            // Channel Voice or Channel Mode status; also ends any SysEx in progress
+            in_sysex = false;
+            data_byte_count = 0;
+            convert_note_off = enabled && note_off_as_note_on && (byte & 0xF0) == 0x80;
+            current_status = convert_note_off ? (0x90 | (byte & 0x0F)) : byte;
+            if (!enabled || current_status != running_status) {
+                dest[nout++] = current_status;
+                running_status = enabled ? current_status : 0;
+            }
+        }
+        else if (in_sysex || current_status == 0) {
+            // SysEx data, or data with no status to go with it; pass it along
+            dest[nout++] = byte;
+        }
+        else {
+            ++data_byte_count;
+            if (convert_note_off && data_byte_count == 2) {
+                byte = 0; // Note Off velocity becomes Note On velocity 0
+            }
+            if (data_byte_count == get_num_data_bytes(current_status)) {
+                // the source may use running status too
+                data_byte_count = 0;
+            }
+            dest[nout++] = byte;
+        }
+    }
+    total_bytes_in += nbytes;
+    total_bytes_out += nout;
+    return nout;
+}
+
+void rppicomidi::Running_status_encoder::task()
+{
+    absolute_time_t now = get_absolute_time();
+    if (absolute_time_diff_us(last_update, now) >= 1000000) {
+        uint64_t bytes_saved = total_bytes_in - total_bytes_out;
+        bytes_saved_last_second = static_cast<uint32_t>(bytes_saved - bytes_saved_at_last_update);
+        if (bytes_saved_last_second > peak_bytes_saved_per_second) {
+            peak_bytes_saved_per_second = bytes_saved_last_second;
+        }
+        bytes_saved_at_last_update = bytes_saved;
+        last_update = now;
+    }
+}
+
+void rppicomidi::Running_status_encoder::reset_stats()
+{
+    total_bytes_in = 0;
+    total_bytes_out = 0;
+    bytes_saved_at_last_update = 0;
+    bytes_saved_last_second = 0;
+    peak_bytes_saved_per_second = 0;
+    last_update = get_absolute_time();
+}
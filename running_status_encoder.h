@@ -0,0 +1,106 @@
+/**
+ * @file running_status_encoder.h
+ * @brief a MIDI byte stream encoder that applies MIDI running status
+ * to the bytes sent out a serial port MIDI OUT
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "pico/stdlib.h"
+namespace rppicomidi
+{
+class Running_status_encoder
+{
+public:
+    Running_status_encoder();
+    Running_status_encoder(Running_status_encoder const&) = delete;
+    void operator=(Running_status_encoder const&) = delete;
+    ~Running_status_encoder()=default;
+
+    /**
+     * @brief copy the MIDI bytes in src to dest, leaving out any
+     * Channel Voice or Channel Mode status byte that matches the
+     * previous one sent.
+     *
+     * If Note Off conversion is enabled, Note Off messages are sent
+     * as Note On messages with velocity 0 so that they can share
+     * running status with Note On messages. System Common messages
+     * and SysEx cancel running status. System Real-Time messages
+     * pass through without changing running status, even in the
+     * middle of another message.
+     *
+     * @param src the bytes to encode
+     * @param nbytes the number of bytes in src
+     * @param dest the encoded bytes. Must have room for nbytes
+     * @return size_t the number of bytes stored in dest
+     */
+    size_t encode(const uint8_t* src, size_t nbytes, uint8_t* dest);
+
+    /**
+     * @brief force the next Channel Voice message to include its status byte
+     *
+     * Call this if encoded bytes were dropped before they were sent.
+     */
+    void cancel_running_status() { running_status = 0; }
+
+    void set_enabled(bool enabled_) { enabled = enabled_; cancel_running_status(); }
+    bool get_enabled() const { return enabled; }
+    void set_note_off_as_note_on(bool convert) { note_off_as_note_on = convert; cancel_running_status(); }
+    bool get_note_off_as_note_on() const { return note_off_as_note_on; }
+
+    /**
+     * @brief update the bytes saved per second statistics. Call this from
+     * the main loop.
+     */
+    void task();
+
+    uint32_t get_bytes_saved_last_second() const { return bytes_saved_last_second; }
+    uint32_t get_peak_bytes_saved_per_second() const { return peak_bytes_saved_per_second; }
+    uint64_t get_total_bytes_in() const { return total_bytes_in; }
+    uint64_t get_total_bytes_out() const { return total_bytes_out; }
+    void reset_stats();
+private:
+    /**
+     * @brief get the number of data bytes that follow a channel status byte
+     */
+    static uint8_t get_num_data_bytes(uint8_t status) { return ((status & 0xE0) == 0xC0) ? 1 : 2; }
+
+    bool enabled;
+    bool note_off_as_note_on;
+    uint8_t running_status;     // last status byte sent, or 0 if none
+    uint8_t current_status;     // status of the message being encoded, or 0 if none
+    uint8_t data_byte_count;    // data bytes of the current message seen so far
+    bool convert_note_off;      // current message is a Note Off being sent as a Note On
+    bool in_sysex;
+
+    uint64_t total_bytes_in;
+    uint64_t total_bytes_out;
+    uint64_t bytes_saved_at_last_update;
+    uint32_t bytes_saved_last_second;
+    uint32_t peak_bytes_saved_per_second;
+    absolute_time_t last_update;
+};
+}
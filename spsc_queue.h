@@ -0,0 +1,154 @@
+/**
+ * @file spsc_queue.h
+ * @brief a lock-free single producer single consumer queue
+ * for passing data between the RP2040 cores
+ *
+ * Exactly one context may call push() and exactly one other context may
+ * call front(), pop() and clear(). The queue needs no spin locks and no
+ * interrupt masking because each index has only one writer.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+namespace rppicomidi
+{
+template<typename T, size_t capacity>
+class Spsc_queue
+{
+public:
+    static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of 2");
+    Spsc_queue() : head{0}, tail{0}, num_staged{0}, high_water{0} {}
+    Spsc_queue(Spsc_queue const&) = delete;
+    void operator=(Spsc_queue const&) = delete;
+    ~Spsc_queue()=default;
+
+    /**
+     * @brief producer side: add item to the back of the queue
+     *
+     * @return true if successful, false if the queue is full
+     */
+    bool push(const T& item)
+    {
+        if (!stage(item))
+            return false;
+        publish();
+        return true;
+    }
+
+    /**
+     * @brief producer side: add item to the back of the queue without
+     * letting the consumer see it until the next publish() or push()
+     *
+     * Staging lets the producer hand the consumer several items at once.
+     *
+     * @return true if successful, false if the queue is full
+     */
+    bool stage(const T& item)
+    {
+        uint32_t tail_ = tail.load(std::memory_order_relaxed) + num_staged;
+        uint32_t count = tail_ - head.load(std::memory_order_acquire);
+        if (count >= capacity)
+            return false;
+        items[tail_ & (capacity - 1)] = item;
+        ++num_staged;
+        if (count + 1 > high_water)
+            high_water = count + 1;
+        return true;
+    }
+
+    /**
+     * @brief producer side: let the consumer see every staged item
+     */
+    void publish()
+    {
+        if (num_staged == 0)
+            return;
+        tail.store(tail.load(std::memory_order_relaxed) + num_staged, std::memory_order_release);
+        num_staged = 0;
+    }
+
+    /**
+     * @brief producer side: return true if there are staged items
+     */
+    bool has_staged() const { return num_staged != 0; }
+
+    /**
+     * @brief consumer side: get the item at the front of the queue
+     * without removing it
+     *
+     * @return a pointer to the item, or nullptr if the queue is empty
+     */
+    T* front()
+    {
+        uint32_t head_ = head.load(std::memory_order_relaxed);
+        if (head_ == tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &items[head_ & (capacity - 1)];
+    }
+
+    /**
+     * @brief consumer side: remove the item at the front of the queue.
+     * Only call this after front() returns non-null.
+     */
+    void pop() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    /**
+     * @brief consumer side: copy the front item to item and remove it
+     *
+     * @return true if successful, false if the queue is empty
+     */
+    bool pop(T& item)
+    {
+        T* item_ptr = front();
+        if (item_ptr == nullptr)
+            return false;
+        item = *item_ptr;
+        pop();
+        return true;
+    }
+
+    /**
+     * @brief consumer side: discard everything in the queue
+     */
+    void clear() { head.store(tail.load(std::memory_order_acquire), std::memory_order_release); }
+
+    size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    static constexpr size_t get_capacity() { return capacity; }
+
+    /**
+     * @brief get the most items the queue has held at once. Written only by the producer.
+     */
+    size_t get_high_water() const { return high_water; }
+private:
+    std::atomic<uint32_t> head; // written only by the consumer
+    std::atomic<uint32_t> tail; // written only by the producer
+    uint32_t num_staged;        // items after tail the consumer cannot see yet; used only by the producer
+    volatile uint32_t high_water;
+    T items[capacity];
+};
+}
@@ -0,0 +1,70 @@
+/**
+ * @file bench_route_transform.cpp
+ * @brief host benchmark of a worst case route transform chain
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include "route_transform.h"
+using namespace rppicomidi;
+
+int main()
+{
+    // Every stage rewrites every Note On message. The notes are 36-99, so
+    // no transpose stage drops one.
+    Route_transform transform;
+    bool added = transform.add_stage(Route_transform::channel_map, 0, 2) &&
+        transform.add_stage(Route_transform::transpose, 12, 0, 127) &&
+        transform.add_stage(Route_transform::velocity_curve, Route_transform::curve, 50) &&
+        transform.add_stage(Route_transform::channel_map, 0, 3) &&
+        transform.add_stage(Route_transform::transpose, -12, 0, 127) &&
+        transform.add_stage(Route_transform::velocity_curve, Route_transform::curve, 200) &&
+        transform.add_stage(Route_transform::channel_map, 0, 1) &&
+        transform.add_stage(Route_transform::transpose, 1, 0, 127);
+    if (!added) {
+        printf("could not build the chain\n");
+        return 1;
+    }
+    const uint32_t num_messages = 10000000;
+    uint32_t checksum = 0;
+    uint32_t dropped = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t idx = 0; idx < num_messages; idx++) {
+        uint8_t packet[4] = {0x09, 0x90, static_cast<uint8_t>(36 + (idx & 63)), static_cast<uint8_t>(1 + (idx & 126))};
+        if (transform.apply(packet))
+            checksum += packet[1] + packet[2] + packet[3];
+        else
+            ++dropped;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    if (elapsed == 0)
+        elapsed = 1;
+    printf("%u Note On messages through %u stages in %.1f ms: %.1f ns each, %.0f messages per second (checksum %u)\n",
+           num_messages, transform.get_num_stages(), elapsed / 1e6, static_cast<double>(elapsed) / num_messages,
+           num_messages * 1e9 / elapsed, checksum);
+    // every stage must have rewritten every message without dropping any
+    return dropped == 0 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file test_held_notes.cpp
+ * @brief host test of the held note tracking behind route transform changes
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include "held_notes.h"
+#include "route_transform.h"
+using namespace rppicomidi;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+typedef std::vector<std::pair<int, int>> Notes; // channel and note number
+
+static void track(Held_notes& held, uint8_t status, uint8_t note, uint8_t velocity)
+{
+    uint8_t packet[4] = {static_cast<uint8_t>(status >> 4), status, note, velocity};
+    held.track(packet);
+}
+
+static void test_tracking()
+{
+    Held_notes held;
+    CHECK(!held.any());
+    track(held, 0x90, 60, 100);
+    track(held, 0x93, 127, 1);
+    track(held, 0x90, 0, 64);
+    CHECK(held.test(0, 60) && held.test(3, 127) && held.test(0, 0));
+    CHECK(!held.test(3, 60));
+    // Polyphonic Key Pressure and Control Change do not release notes
+    track(held, 0xA0, 60, 10);
+    track(held, 0xB0, 60, 0);
+    CHECK(held.test(0, 60));
+    track(held, 0x80, 60, 64);
+    track(held, 0x93, 127, 0); // a Note On with velocity 0 is a Note Off
+    CHECK(!held.test(0, 60) && !held.test(3, 127));
+    CHECK(held.any());
+    track(held, 0x80, 0, 0);
+    CHECK(!held.any());
+}
+
+static void test_for_each_order()
+{
+    Held_notes held;
+    track(held, 0x95, 33, 100);
+    track(held, 0x90, 95, 100);
+    track(held, 0x90, 31, 100);
+    track(held, 0x9F, 127, 100);
+    Notes notes;
+    held.for_each([&](uint8_t channel, uint8_t note) { notes.push_back({channel, note}); });
+    CHECK((notes == Notes{{0, 31}, {0, 95}, {5, 33}, {15, 127}}));
+    held.clear();
+    CHECK(!held.any());
+}
+
+static void test_note_off_through_old_transform()
+{
+    // the hub turns held notes off through the transform they went through
+    Route_transform old_transform;
+    CHECK(old_transform.add_stage(Route_transform::transpose, 12, 0, 127));
+    CHECK(old_transform.add_stage(Route_transform::channel_map, 0, 2));
+    Held_notes held;
+    uint8_t note_on[4] = {0x9, 0x90, 60, 100};
+    held.track(note_on);
+    CHECK(old_transform.apply(note_on));
+    Notes note_offs;
+    held.for_each([&](uint8_t channel, uint8_t note) {
+        uint8_t note_off[4] = {0x8, static_cast<uint8_t>(0x80 | channel), note, 0};
+        if (old_transform.apply(note_off))
+            note_offs.push_back({note_off[1] & 0xF, note_off[2]});
+    });
+    // the Note On went out as note 72 on channel 2
+    CHECK(note_on[1] == 0x91 && note_on[2] == 72);
+    CHECK((note_offs == Notes{{1, 72}}));
+
+    Route_transform same;
+    CHECK(same.add_stage(Route_transform::transpose, 12, 0, 127));
+    CHECK(same.add_stage(Route_transform::channel_map, 0, 2));
+    CHECK(same == old_transform);
+    CHECK(same.remove_stage(1));
+    CHECK(!(same == old_transform));
+}
+
+int main()
+{
+    test_tracking();
+    test_for_each_order();
+    test_note_off_through_old_transform();
+    if (failures == 0)
+        printf("test_held_notes passed\n");
+    return failures == 0 ? 0 : 1;
+}
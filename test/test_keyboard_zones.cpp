@@ -0,0 +1,175 @@
+/**
+ * @file test_keyboard_zones.cpp
+ * @brief host test of the keyboard zones that split a MIDI IN port by note range
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cstdio>
+#include "keyboard_zones.h"
+using namespace rppicomidi;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+typedef Keyboard_zones<3> Zones;
+typedef Port_mask<3> Mask;
+
+// the tests only put ports 1 and 2 in zones
+static const uint8_t num_ports = 3;
+
+// the mask of the ports whose bits are set in ports
+static Mask make_mask(unsigned ports)
+{
+    Mask mask;
+    for (uint8_t port = 0; port < num_ports; port++) {
+        if (ports & (1u << port))
+            mask.set(port);
+    }
+    return mask;
+}
+
+// return the ports a note message goes to as bits
+static unsigned route(Zones& zones, uint8_t status, uint8_t note, uint8_t velocity)
+{
+    uint8_t packet[4] = {static_cast<uint8_t>(status >> 4), status, note, velocity};
+    uint8_t target = zones.resolve(packet);
+    unsigned ports = 0;
+    for (uint8_t port = 0; port < num_ports; port++) {
+        if (zones.sends_to(target, port))
+            ports |= 1u << port;
+    }
+    return ports;
+}
+
+static void test_split()
+{
+    Zones zones;
+    CHECK(zones.set_zone(0, 0, 59, make_mask(0x2)));
+    CHECK(zones.set_zone(1, 60, 127, make_mask(0x4)));
+    CHECK(!zones.set_zone(2, 50, 70, make_mask(0x2)));
+    CHECK(route(zones, 0x90, 40, 100) == 0x3);
+    CHECK(route(zones, 0x90, 72, 100) == 0x5);
+    CHECK(route(zones, 0x80, 40, 0) == 0x3);
+    CHECK(route(zones, 0x90, 72, 0) == 0x5);
+}
+
+static void test_reassign_while_held()
+{
+    Zones zones;
+    CHECK(zones.set_zone(0, 0, 59, make_mask(0x2)));
+    CHECK(zones.set_zone(1, 60, 127, make_mask(0x6)));
+    CHECK(route(zones, 0x90, 40, 100) == 0x3);
+    // move zone 0 from port 1 to port 2 while note 40 is held
+    CHECK(zones.set_zone(0, 0, 59, make_mask(0x4)));
+    CHECK(route(zones, 0xA0, 40, 64) == 0x3);
+    CHECK(route(zones, 0x80, 40, 0) == 0x3);
+    CHECK(route(zones, 0x90, 40, 100) == 0x5);
+    CHECK(route(zones, 0x80, 40, 0) == 0x5);
+}
+
+static void test_change_range_while_held()
+{
+    Zones zones;
+    CHECK(zones.set_zone(0, 0, 59, make_mask(0x2)));
+    CHECK(zones.set_zone(1, 60, 127, make_mask(0x4)));
+    CHECK(route(zones, 0x91, 50, 100) == 0x3);
+    CHECK(zones.set_zone(0, 0, 47, make_mask(0x2)));
+    CHECK(zones.set_zone(1, 48, 127, make_mask(0x4)));
+    CHECK(route(zones, 0x91, 50, 0) == 0x3);
+    CHECK(route(zones, 0x91, 50, 100) == 0x5);
+}
+
+static void test_remove_while_held()
+{
+    Zones zones;
+    CHECK(zones.set_zone(0, 0, 59, make_mask(0x6)));
+    CHECK(zones.set_zone(1, 60, 127, make_mask(0x4)));
+    CHECK(route(zones, 0x90, 70, 100) == 0x5);
+    zones.remove_zone(1);
+    CHECK(route(zones, 0x80, 70, 0) == 0x5);
+    // note 70 is in no zone now, so it only goes to port 0
+    CHECK(route(zones, 0x90, 70, 100) == 0x1);
+    CHECK(route(zones, 0x80, 70, 0) == 0x1);
+}
+
+static void test_zone_added_while_held()
+{
+    // a note in no zone goes to port 1 until port 1 joins a zone
+    Zones zones;
+    CHECK(zones.set_zone(1, 60, 127, make_mask(0x4)));
+    CHECK(route(zones, 0x90, 40, 100) == 0x3);
+    CHECK(zones.set_zone(1, 60, 127, make_mask(0x2)));
+    CHECK(route(zones, 0x90, 41, 100) == 0x5);
+    CHECK(route(zones, 0x80, 40, 0) == 0x3);
+    CHECK(route(zones, 0x80, 41, 0) == 0x5);
+}
+
+static void test_reload_while_held()
+{
+    // loading a preset removes the zones and sets them again; here the
+    // split moves from 60 to 72 while notes 50 and 70 are held
+    Zones zones;
+    CHECK(zones.set_zone(0, 0, 59, make_mask(0x2)));
+    CHECK(zones.set_zone(1, 60, 127, make_mask(0x4)));
+    CHECK(route(zones, 0x90, 50, 100) == 0x3);
+    CHECK(route(zones, 0x90, 70, 100) == 0x5);
+    zones.remove_zones();
+    CHECK(zones.empty());
+    CHECK(zones.set_zone(0, 0, 71, make_mask(0x2)));
+    CHECK(zones.set_zone(1, 72, 127, make_mask(0x4)));
+    CHECK(route(zones, 0xA0, 70, 64) == 0x5);
+    CHECK(route(zones, 0x80, 70, 0) == 0x5);
+    CHECK(route(zones, 0x90, 50, 0) == 0x3);
+    CHECK(route(zones, 0x90, 70, 100) == 0x3);
+    CHECK(route(zones, 0x80, 70, 0) == 0x3);
+}
+
+static void test_targets_are_reused()
+{
+    // each reassign while a note is held retires a target; the Note Off
+    // must make it a spare again
+    Zones zones;
+    CHECK(zones.set_zone(1, 64, 127, make_mask(0x6)));
+    for (int pass = 0; pass < 3 * Zones::max_targets; pass++) {
+        unsigned port = 1 + (pass & 1);
+        CHECK(zones.set_zone(0, 0, 63, make_mask(1u << port)));
+        CHECK(route(zones, 0x90, 60, 100) == (1u | (1u << port)));
+        CHECK(zones.set_zone(0, 0, 63, make_mask(1u << (3 - port))));
+        CHECK(route(zones, 0x80, 60, 0) == (1u | (1u << port)));
+    }
+}
+
+int main()
+{
+    test_split();
+    test_reassign_while_held();
+    test_change_range_while_held();
+    test_remove_while_held();
+    test_zone_added_while_held();
+    test_reload_while_held();
+    test_targets_are_reused();
+    if (failures == 0)
+        printf("test_keyboard_zones passed\n");
+    return failures == 0 ? 0 : 1;
+}
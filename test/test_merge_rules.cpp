@@ -0,0 +1,141 @@
+/**
+ * @file test_merge_rules.cpp
+ * @brief host test of the SysEx timeout and orphan rules of the merge stage
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cstdio>
+#include "merge_rules.h"
+using namespace rppicomidi;
+using merge_rules::Merge;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+static const uint8_t note_on[4] = {0x9, 0x90, 60, 100};
+static const uint8_t clock[4] = {0xF, 0xF8, 0, 0};
+static const uint8_t sysex_start[4] = {0x4, 0xF0, 0x7E, 0x00};
+static const uint8_t sysex_more[4] = {0x4, 0x01, 0x02, 0x03};
+static const uint8_t sysex_end[4] = {0x6, 0x04, 0xF7, 0};
+static const uint8_t sysex_end_only[4] = {0x5, 0xF7, 0, 0};
+static const uint8_t sysex_whole[4] = {0x7, 0xF0, 0x7E, 0xF7};
+
+// The SysEx state of one MIDI OUT port, kept the way
+// Midi2usbhub::merge_packet() and service_sysex_timeouts() keep it.
+// MIDI IN ports are numbered from 1; owner 0 means no SysEx message.
+struct Out_port
+{
+    int owner = 0;
+    uint32_t last_time = 0;
+    unsigned orphans = 0;
+};
+
+static Merge merge(Out_port& port, int from, const uint8_t packet[4], uint32_t now)
+{
+    Merge result = merge_rules::get_merge(packet, port.owner == from, port.owner != 0 && port.owner != from);
+    if (result == Merge::orphan)
+        ++port.orphans;
+    if (result != Merge::send || midi_packet::is_realtime(packet))
+        return result;
+    bool ends = midi_packet::get_cin(packet) != 0x4;
+    if (merge_rules::is_sysex_start(packet) && !ends) {
+        port.owner = from;
+        port.last_time = now;
+    }
+    else if (port.owner == from) {
+        if (ends)
+            port.owner = 0;
+        else
+            port.last_time = now;
+    }
+    return result;
+}
+
+static void check_timeout(Out_port& port, uint32_t timeout_ms, uint32_t now)
+{
+    if (port.owner != 0 && merge_rules::is_sysex_timed_out(port.last_time, timeout_ms, now))
+        port.owner = 0;
+}
+
+static void test_get_merge()
+{
+    CHECK(merge_rules::get_merge(note_on, false, false) == Merge::send);
+    CHECK(merge_rules::get_merge(note_on, false, true) == Merge::hold);
+    CHECK(merge_rules::get_merge(clock, false, true) == Merge::send);
+    CHECK(merge_rules::get_merge(sysex_start, false, false) == Merge::send);
+    CHECK(merge_rules::get_merge(sysex_start, false, true) == Merge::hold);
+    CHECK(merge_rules::get_merge(sysex_more, true, false) == Merge::send);
+    CHECK(merge_rules::get_merge(sysex_end, true, false) == Merge::send);
+    CHECK(merge_rules::get_merge(sysex_more, false, false) == Merge::orphan);
+    CHECK(merge_rules::get_merge(sysex_end, false, false) == Merge::orphan);
+    CHECK(merge_rules::get_merge(sysex_end_only, false, false) == Merge::orphan);
+    CHECK(merge_rules::get_merge(sysex_whole, false, false) == Merge::send);
+    // a port that another port holds up waits, even for the rest of its own old message
+    CHECK(merge_rules::get_merge(sysex_more, false, true) == Merge::hold);
+}
+
+static void test_timed_out()
+{
+    CHECK(!merge_rules::is_sysex_timed_out(1000, 500, 1000 + 499999));
+    CHECK(merge_rules::is_sysex_timed_out(1000, 500, 1000 + 500000));
+    // time_us_32() wraps about every 71 minutes
+    CHECK(!merge_rules::is_sysex_timed_out(0xFFFFFF00, 500, 0x10));
+    CHECK(merge_rules::is_sysex_timed_out(0xFFFFFF00, 500, 0xFFFFFF00 + 500000));
+}
+
+static void test_orphans_after_timeout()
+{
+    Out_port port;
+    CHECK(merge(port, 1, sysex_start, 0) == Merge::send);
+    CHECK(port.owner == 1);
+    CHECK(merge(port, 2, note_on, 100) == Merge::hold);
+    CHECK(merge(port, 1, sysex_more, 200000) == Merge::send);
+    check_timeout(port, 500, 699999);
+    CHECK(port.owner == 1);
+    check_timeout(port, 500, 700000);
+    CHECK(port.owner == 0);
+    // port 1 wakes up and sends the rest of the message the hub ended
+    CHECK(merge(port, 1, sysex_more, 800000) == Merge::orphan);
+    CHECK(merge(port, 1, sysex_end, 800100) == Merge::orphan);
+    CHECK(port.orphans == 2);
+    CHECK(merge(port, 2, note_on, 800200) == Merge::send);
+    CHECK(merge(port, 1, clock, 800300) == Merge::send);
+    CHECK(merge(port, 1, sysex_whole, 800400) == Merge::send);
+    CHECK(port.owner == 0);
+    // the next message from port 1 is not an orphan
+    CHECK(merge(port, 1, sysex_start, 900000) == Merge::send);
+    CHECK(merge(port, 1, sysex_end, 900100) == Merge::send);
+    CHECK(port.owner == 0);
+    CHECK(port.orphans == 2);
+}
+
+int main()
+{
+    test_get_merge();
+    test_timed_out();
+    test_orphans_after_timeout();
+    if (failures == 0)
+        printf("test_merge_rules passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file test_out_queue_rules.cpp
+ * @brief host test of the MIDI OUT queue release and thinning rules
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cstdio>
+#include <vector>
+#include "out_queue_rules.h"
+using namespace rppicomidi;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+struct Queued
+{
+    uint8_t packet[4];
+    uint32_t timestamp;
+};
+
+struct Sweep_result
+{
+    std::vector<uint8_t> sent;  // the controller values in the order they went out
+    uint32_t thinned = 0;
+};
+
+// Send a mod wheel sweep 0-127, one value per millisecond, through a queue
+// that follows the same steps as Midi2usbhub::queue_out_packet() and
+// Midi2usbhub::service_out_queues()
+static Sweep_result run_sweep(uint32_t fixed_latency_us, uint32_t bytes_per_second)
+{
+    Packet_pool<Queued, 256> pool;
+    Packet_list list;
+    Token_bucket shaper;
+    shaper.configure(bytes_per_second, 3, 0);
+    bool behind = false;
+    Sweep_result result;
+    for (uint32_t now = 0; now < 10000000 && (now <= 127000 || !list.empty()); now += 1000)
+    {
+        if (now <= 127000)
+        {
+            Queued cc = {{0x0B, 0xB0, 1, static_cast<uint8_t>(now / 1000)}, now};
+            if (behind && !list.empty())
+                result.thinned += out_queue_rules::thin_packets(pool, list, cc.packet);
+            CHECK(pool.push_back(list, cc));
+        }
+        behind = false;
+        Queued* head;
+        while ((head = pool.front(list)) != nullptr)
+        {
+            uint32_t wait_us = 0;
+            auto release = out_queue_rules::get_release(head->timestamp, fixed_latency_us, shaper, now, wait_us);
+            if (release != out_queue_rules::Release::send)
+            {
+                behind = release == out_queue_rules::Release::throttle;
+                break;
+            }
+            shaper.take(3, now);
+            result.sent.push_back(head->packet[3]);
+            pool.pop_front(list);
+        }
+    }
+    return result;
+}
+
+static void test_fixed_latency_sweep_is_not_thinned()
+{
+    // every value waits 5 ms, so the queue always holds about 5 values
+    Sweep_result result = run_sweep(5000, 0);
+    CHECK(result.thinned == 0);
+    CHECK(result.sent.size() == 128);
+    for (size_t idx = 0; idx < result.sent.size(); idx++)
+        CHECK(result.sent[idx] == idx);
+}
+
+static void test_slow_port_sweep_is_thinned()
+{
+    // about one 3 byte message every 10 ms: the queue falls behind
+    Sweep_result result = run_sweep(0, 300);
+    CHECK(result.thinned > 0);
+    CHECK(result.sent.size() + result.thinned == 128);
+    CHECK(!result.sent.empty() && result.sent.back() == 127);
+    for (size_t idx = 1; idx < result.sent.size(); idx++)
+        CHECK(result.sent[idx] > result.sent[idx - 1]);
+}
+
+static void test_release()
+{
+    Token_bucket unlimited;
+    unlimited.configure(0, 3, 0);
+    uint32_t wait_us = 0;
+    CHECK(out_queue_rules::get_release(1000, 0, unlimited, 1000, wait_us) == out_queue_rules::Release::send);
+    CHECK(out_queue_rules::get_release(1000, 500, unlimited, 1200, wait_us) == out_queue_rules::Release::hold);
+    CHECK(wait_us == 300);
+    CHECK(out_queue_rules::get_release(1000, 500, unlimited, 1500, wait_us) == out_queue_rules::Release::send);
+    // release times work across time_us_32() wrapping around
+    CHECK(out_queue_rules::get_release(0xFFFFFF00u, 500, unlimited, 0x10, wait_us) == out_queue_rules::Release::hold);
+    CHECK(wait_us == 500 - 0x110);
+    Token_bucket slow;
+    slow.configure(3000, 3, 0);
+    slow.take(6, 0);
+    CHECK(out_queue_rules::get_release(0, 0, slow, 0, wait_us) == out_queue_rules::Release::throttle);
+    CHECK(wait_us == 1000);
+}
+
+int main()
+{
+    test_release();
+    test_fixed_latency_sweep_is_not_thinned();
+    test_slow_port_sweep_is_thinned();
+    if (failures == 0)
+        printf("test_out_queue_rules passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+/**
+ * @file test_route_transform.cpp
+ * @brief host test of the lookup tables of each route transform stage type
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cstdio>
+#include "route_transform.h"
+using namespace rppicomidi;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+// the packet after transform, or all zeros if transform dropped it
+struct Result
+{
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    bool operator==(const Result& other) const { return status == other.status && data1 == other.data1 && data2 == other.data2; }
+};
+
+static Result run(const Route_transform& transform, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    uint8_t packet[4] = {static_cast<uint8_t>(status >> 4), status, data1, data2};
+    if (!transform.apply(packet))
+        return Result{0, 0, 0};
+    return Result{packet[1], packet[2], packet[3]};
+}
+
+static void test_channel_map()
+{
+    Route_transform transform;
+    CHECK(transform.add_stage(Route_transform::channel_map, 3, 5));
+    CHECK((run(transform, 0x92, 60, 100) == Result{0x94, 60, 100}));
+    CHECK((run(transform, 0xE2, 0, 64) == Result{0xE4, 0, 64}));
+    CHECK((run(transform, 0x90, 60, 100) == Result{0x90, 60, 100}));
+    // System messages have no channel
+    CHECK((run(transform, 0xF8, 0, 0) == Result{0xF8, 0, 0}));
+
+    Route_transform all;
+    CHECK(all.add_stage(Route_transform::channel_map, 0, 16));
+    for (uint8_t channel = 0; channel < 16; channel++) {
+        CHECK((run(all, 0x80 | channel, 60, 0) == Result{0x8F, 60, 0}));
+        CHECK((run(all, 0xB0 | channel, 7, 127) == Result{0xBF, 7, 127}));
+    }
+
+    Route_transform bad;
+    CHECK(!bad.add_stage(Route_transform::channel_map, 17, 1));
+    CHECK(!bad.add_stage(Route_transform::channel_map, 1, 0));
+    CHECK(!bad.add_stage(Route_transform::channel_map, 1, 17));
+    CHECK(bad.empty());
+}
+
+static void test_transpose()
+{
+    Route_transform transform;
+    CHECK(transform.add_stage(Route_transform::transpose, 12, 0, 59));
+    // the edges of the note range
+    CHECK((run(transform, 0x90, 0, 100) == Result{0x90, 12, 100}));
+    CHECK((run(transform, 0x90, 59, 100) == Result{0x90, 71, 100}));
+    CHECK((run(transform, 0x90, 60, 100) == Result{0x90, 60, 100}));
+    // Note Off and Polyphonic Key Pressure move with the Note On; Control Change does not
+    CHECK((run(transform, 0x81, 59, 0) == Result{0x81, 71, 0}));
+    CHECK((run(transform, 0xA1, 59, 30) == Result{0xA1, 71, 30}));
+    CHECK((run(transform, 0xB1, 59, 30) == Result{0xB1, 59, 30}));
+
+    // notes that would land outside 0-127 are dropped
+    Route_transform up;
+    CHECK(up.add_stage(Route_transform::transpose, 12, 0, 127));
+    CHECK((run(up, 0x90, 115, 100) == Result{0x90, 127, 100}));
+    CHECK((run(up, 0x90, 116, 100) == Result{0, 0, 0}));
+    CHECK((run(up, 0x80, 127, 0) == Result{0, 0, 0}));
+    Route_transform down;
+    CHECK(down.add_stage(Route_transform::transpose, -5, 0, 127));
+    CHECK((run(down, 0x90, 5, 100) == Result{0x90, 0, 100}));
+    CHECK((run(down, 0x90, 4, 100) == Result{0, 0, 0}));
+
+    Route_transform bad;
+    CHECK(!bad.add_stage(Route_transform::transpose, 128, 0, 127));
+    CHECK(!bad.add_stage(Route_transform::transpose, 1, 60, 59));
+    CHECK(!bad.add_stage(Route_transform::transpose, 1, 0, 128));
+    CHECK(bad.empty());
+}
+
+static void test_cc_map()
+{
+    Route_transform transform;
+    CHECK(transform.add_stage(Route_transform::cc_map, 1, 11));
+    CHECK((run(transform, 0xB0, 1, 64) == Result{0xB0, 11, 64}));
+    CHECK((run(transform, 0xB5, 1, 0) == Result{0xB5, 11, 0}));
+    CHECK((run(transform, 0xB0, 2, 64) == Result{0xB0, 2, 64}));
+    // only Control Change messages have a controller number
+    CHECK((run(transform, 0x90, 1, 64) == Result{0x90, 1, 64}));
+    CHECK(!transform.add_stage(Route_transform::cc_map, 128, 1));
+}
+
+static void test_velocity()
+{
+    Route_transform fixed;
+    CHECK(fixed.add_stage(Route_transform::velocity_curve, Route_transform::fixed, 100));
+    CHECK((run(fixed, 0x90, 60, 1) == Result{0x90, 60, 100}));
+    CHECK((run(fixed, 0x90, 60, 127) == Result{0x90, 60, 100}));
+    // a Note On with velocity 0 is a Note Off and stays 0
+    CHECK((run(fixed, 0x90, 60, 0) == Result{0x90, 60, 0}));
+    // only Note On velocities change
+    CHECK((run(fixed, 0x80, 60, 64) == Result{0x80, 60, 64}));
+    CHECK((run(fixed, 0xA0, 60, 64) == Result{0xA0, 60, 64}));
+
+    Route_transform range;
+    CHECK(range.add_stage(Route_transform::velocity_curve, Route_transform::range, 20, 100));
+    CHECK((run(range, 0x90, 60, 1) == Result{0x90, 60, 20}));
+    CHECK((run(range, 0x90, 60, 64) == Result{0x90, 60, 60}));
+    CHECK((run(range, 0x90, 60, 127) == Result{0x90, 60, 100}));
+    CHECK((run(range, 0x90, 60, 0) == Result{0x90, 60, 0}));
+    // a range may run downward
+    Route_transform inverted;
+    CHECK(inverted.add_stage(Route_transform::velocity_curve, Route_transform::range, 127, 1));
+    CHECK((run(inverted, 0x90, 60, 1) == Result{0x90, 60, 127}));
+    CHECK((run(inverted, 0x90, 60, 127) == Result{0x90, 60, 1}));
+
+    Route_transform linear;
+    CHECK(linear.add_stage(Route_transform::velocity_curve, Route_transform::curve, 100));
+    for (uint8_t velocity = 0; velocity < 128; velocity++)
+        CHECK((run(linear, 0x90, 60, velocity) == Result{0x90, 60, velocity}));
+    Route_transform softer;
+    CHECK(softer.add_stage(Route_transform::velocity_curve, Route_transform::curve, 200));
+    CHECK((run(softer, 0x90, 60, 64) == Result{0x90, 60, 32}));
+    CHECK((run(softer, 0x90, 60, 127) == Result{0x90, 60, 127}));
+    CHECK((run(softer, 0x90, 60, 0) == Result{0x90, 60, 0}));
+    Route_transform louder;
+    CHECK(louder.add_stage(Route_transform::velocity_curve, Route_transform::curve, 50));
+    CHECK((run(louder, 0x90, 60, 32) == Result{0x90, 60, 64}));
+    // a steep curve never turns a Note On into a Note Off
+    Route_transform steep;
+    CHECK(steep.add_stage(Route_transform::velocity_curve, Route_transform::curve, 1000));
+    CHECK((run(steep, 0x90, 60, 1) == Result{0x90, 60, 1}));
+
+    Route_transform bad;
+    CHECK(!bad.add_stage(Route_transform::velocity_curve, Route_transform::fixed, 0));
+    CHECK(!bad.add_stage(Route_transform::velocity_curve, Route_transform::range, 0, 127));
+    CHECK(!bad.add_stage(Route_transform::velocity_curve, Route_transform::curve, 9));
+    CHECK(!bad.add_stage(Route_transform::velocity_curve, Route_transform::curve, 1001));
+    CHECK(!bad.add_stage(Route_transform::velocity_curve, Route_transform::num_velocity_modes, 64));
+    CHECK(bad.empty());
+}
+
+static void test_remove_stage()
+{
+    Route_transform transform;
+    CHECK(transform.add_stage(Route_transform::transpose, 12, 0, 127));
+    CHECK(transform.add_stage(Route_transform::channel_map, 0, 2));
+    CHECK(transform.add_stage(Route_transform::transpose, -24, 0, 127));
+    CHECK((run(transform, 0x90, 60, 100) == Result{0x91, 48, 100}));
+    // the later stages move up and keep their tables
+    CHECK(transform.remove_stage(0));
+    CHECK(transform.get_num_stages() == 2);
+    CHECK(transform.get_stage(0).type == Route_transform::channel_map);
+    CHECK((run(transform, 0x90, 60, 100) == Result{0x91, 36, 100}));
+    CHECK((run(transform, 0x90, 20, 100) == Result{0, 0, 0}));
+    CHECK(transform.remove_stage(1));
+    CHECK((run(transform, 0x90, 20, 100) == Result{0x91, 20, 100}));
+    CHECK(!transform.remove_stage(1));
+    CHECK(transform.remove_stage(0));
+    CHECK(transform.empty());
+    CHECK((run(transform, 0x95, 20, 100) == Result{0x95, 20, 100}));
+}
+
+static void test_full_chain()
+{
+    Route_transform transform;
+    for (uint8_t idx = 0; idx < Route_transform::max_stages; idx++)
+        CHECK(transform.add_stage(Route_transform::transpose, 1, 0, 127));
+    CHECK(!transform.add_stage(Route_transform::transpose, 1, 0, 127));
+    CHECK((run(transform, 0x90, 60, 100) == Result{0x90, 68, 100}));
+}
+
+int main()
+{
+    test_channel_map();
+    test_transpose();
+    test_cc_map();
+    test_velocity();
+    test_remove_stage();
+    test_full_chain();
+    if (failures == 0)
+        printf("test_route_transform passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file test_timer_wheel.cpp
+ * @brief host test of the hashed timer wheel behind the route delay lines
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cstdio>
+#include <vector>
+#include "timer_wheel.h"
+using namespace rppicomidi;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+typedef Timer_wheel<int, 16, 32> Wheel;
+
+static void test_expires_in_order()
+{
+    Wheel wheel;
+    std::vector<int> expired;
+    auto collect = [&](int item) { expired.push_back(item); };
+    CHECK(wheel.schedule(1, 105, 100, collect));
+    CHECK(wheel.schedule(2, 103, 100, collect));
+    CHECK(wheel.schedule(3, 105, 100, collect));
+    CHECK(wheel.schedule(4, 90, 100, collect)); // overdue: expires at the next tick
+    wheel.advance(101, collect);
+    CHECK(expired == std::vector<int>({4}));
+    wheel.advance(104, collect);
+    CHECK(expired == std::vector<int>({4, 2}));
+    wheel.advance(105, collect);
+    CHECK(expired == std::vector<int>({4, 2, 1, 3}));
+    CHECK(wheel.empty());
+}
+
+static void test_schedule_after_long_gap()
+{
+    // advance() is not called for more than a turn of the wheel, as when the
+    // routing core is held off during a flash write
+    Wheel wheel;
+    std::vector<int> expired;
+    auto collect = [&](int item) { expired.push_back(item); };
+    CHECK(wheel.schedule(1, 110, 100, collect));
+    // 10 ticks from now maps to a slot the catch-up from tick 100 would visit
+    CHECK(wheel.schedule(2, 1010, 1000, collect));
+    CHECK(expired == std::vector<int>({1}));
+    wheel.advance(1000, collect);
+    wheel.advance(1009, collect);
+    CHECK(expired == std::vector<int>({1}));
+    wheel.advance(1010, collect);
+    CHECK(expired == std::vector<int>({1, 2}));
+    CHECK(wheel.empty());
+}
+
+static void test_full_wheel()
+{
+    Wheel wheel;
+    auto ignore = [](int) {};
+    for (int item = 0; item < Wheel::get_capacity(); item++)
+        CHECK(wheel.schedule(item, 5, 0, ignore));
+    CHECK(!wheel.schedule(99, 5, 0, ignore));
+    CHECK(wheel.get_num_waiting() == Wheel::get_capacity());
+}
+
+int main()
+{
+    test_expires_in_order();
+    test_schedule_after_long_gap();
+    test_full_wheel();
+    if (failures == 0)
+        printf("test_timer_wheel passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file timer_wheel.h
+ * @brief a hashed timer wheel of items that expire at a given tick
+ * that visits only the items that expire at each tick
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+#include "packet_pool.h"
+namespace rppicomidi
+{
+/**
+ * @brief a hashed timer wheel of up to capacity items of type T
+ *
+ * Each of the num_slots slots holds a FIFO list of the items that expire
+ * at one tick. An item must expire fewer than num_slots ticks after the
+ * wheel's current tick, so every item in a slot expires at the same tick
+ * and scheduling an item or expiring it costs the same no matter how many
+ * items are waiting. Items that expire at the same tick expire in the order
+ * they were scheduled. The items live in a preallocated Packet_pool. The
+ * wheel does no locking; only one core may use it at a time.
+ */
+template<typename T, uint16_t num_slots, uint16_t capacity>
+class Timer_wheel
+{
+public:
+    static_assert(num_slots != 0 && (num_slots & (num_slots - 1)) == 0, "Timer_wheel num_slots must be a power of 2");
+
+    Timer_wheel() : current_tick{0} {}
+
+    bool empty() const { return pool.get_num_free() == capacity; }
+    uint16_t get_num_waiting() const { return capacity - pool.get_num_free(); }
+    uint16_t get_high_water() const { return pool.get_high_water(); }
+    void reset_high_water() { pool.reset_high_water(); }
+    static uint16_t get_capacity() { return capacity; }
+
+    /**
+     * @brief get the last tick advance() expired
+     */
+    uint32_t get_tick() const { return current_tick; }
+
+    /**
+     * @brief add a copy of item to the wheel to expire at due_tick. The
+     * wheel first advances to now_tick and calls fn(item) for every item
+     * that expires by then, so an item scheduled after advance() has fallen
+     * behind never lands in a slot the catch-up would expire early. An item
+     * due at or before now_tick expires at the next tick. An item due
+     * num_slots or more ticks after now_tick expires early.
+     *
+     * @param now_tick the tick now
+     * @return true if successful, false if the wheel is full
+     */
+    template<typename Fn>
+    bool schedule(const T& item, uint32_t due_tick, uint32_t now_tick, Fn fn)
+    {
+        advance(now_tick, fn);
+        int32_t ticks = static_cast<int32_t>(due_tick - current_tick);
+        if (ticks < 1)
+            due_tick = current_tick + 1;
+        else if (ticks >= num_slots)
+            due_tick = current_tick + num_slots - 1;
+        return pool.push_back(slots[due_tick & (num_slots - 1)], item);
+    }
+
+    /**
+     * @brief call fn(item) for every item that expires after the current
+     * tick up to and including now_tick, earliest first, and remove the
+     * items from the wheel. fn must not call schedule().
+     */
+    template<typename Fn>
+    void advance(uint32_t now_tick, Fn fn)
+    {
+        int32_t ticks = static_cast<int32_t>(now_tick - current_tick);
+        if (ticks <= 0)
+            return;
+        if (empty())
+        {
+            current_tick = now_tick;
+            return;
+        }
+        if (ticks > num_slots)
+            ticks = num_slots; // one turn of the wheel visits every slot
+        while (ticks-- > 0)
+        {
+            auto& slot = slots[++current_tick & (num_slots - 1)];
+            T* item;
+            while ((item = pool.front(slot)) != nullptr)
+            {
+                fn(*item);
+                pool.pop_front(slot);
+            }
+        }
+        current_tick = now_tick;
+    }
+private:
+    Packet_pool<T, capacity> pool;
+    Packet_list slots[num_slots];
+    uint32_t current_tick;
+};
+}
@@ -0,0 +1,113 @@
+/**
+ * @file token_bucket.h
+ * @brief a token bucket that limits the rate of bytes sent to a MIDI OUT port
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#pragma once
+#include <cstdint>
+namespace rppicomidi
+{
+/**
+ * @brief limit the long term byte rate to a port's wire rate while
+ * allowing short bursts
+ *
+ * The bucket fills at bytes_per_second up to burst_bytes. A sender may send
+ * while the bucket is not in debt; each send takes its size from the bucket
+ * and may leave it in debt, so a message never has to be split. Tokens are
+ * kept in byte-microseconds so refilling needs no division.
+ */
+class Token_bucket
+{
+public:
+    Token_bucket() : bytes_per_second{0}, burst{0}, tokens{0}, last_refill{0} {}
+
+    /**
+     * @brief set the rate and burst size and fill the bucket
+     *
+     * @param bytes_per_second_ the long term rate; 0 means no limit
+     * @param burst_bytes the most bytes that can go out back to back
+     * @param now the time_us_32() time
+     */
+    void configure(uint32_t bytes_per_second_, uint32_t burst_bytes, uint32_t now)
+    {
+        bytes_per_second = bytes_per_second_;
+        burst = static_cast<int64_t>(burst_bytes) * 1000000;
+        tokens = burst;
+        last_refill = now;
+    }
+
+    /**
+     * @brief return true if the bucket is not in debt
+     */
+    bool conforms(uint32_t now)
+    {
+        refill(now);
+        return tokens >= 0;
+    }
+
+    /**
+     * @brief take nbytes worth of tokens from the bucket
+     */
+    void take(uint32_t nbytes, uint32_t now)
+    {
+        refill(now);
+        tokens -= static_cast<int64_t>(nbytes) * 1000000;
+    }
+
+    /**
+     * @brief get how long until the bucket is out of debt
+     *
+     * @return uint32_t the wait in microseconds; 0 if the bucket conforms now
+     */
+    uint32_t get_wait_us(uint32_t now)
+    {
+        refill(now);
+        if (tokens >= 0)
+            return 0;
+        return static_cast<uint32_t>((-tokens + bytes_per_second - 1) / bytes_per_second);
+    }
+
+    uint32_t get_bytes_per_second() const { return bytes_per_second; }
+private:
+    void refill(uint32_t now)
+    {
+        if (bytes_per_second == 0)
+        {
+            tokens = burst;
+            return;
+        }
+        uint32_t elapsed = now - last_refill;
+        last_refill = now;
+        tokens += static_cast<int64_t>(elapsed) * bytes_per_second;
+        if (tokens > burst)
+            tokens = burst;
+    }
+
+    uint32_t bytes_per_second;
+    int64_t burst;       // in byte-microseconds
+    int64_t tokens;      // in byte-microseconds; negative means in debt
+    uint32_t last_refill; // time_us_32() time of the last refill
+};
+}